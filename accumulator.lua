@@ -0,0 +1,136 @@
+-- Accumulation of tensors into a shared one (e.g. gradients applied to
+-- parameters, Hogwild-style), by several threads at once. The shared
+-- tensor is split into stripes, each one guarded by its own mutex: threads
+-- updating it at the same time lock different stripes, starting each at a
+-- different one. An accumulator is a table of a pointer and mutex ids,
+-- hence can be given to a job, in which threads.Accumulator(acc) attaches
+-- to it.
+
+local clib = require 'libthreads'
+
+local Accumulator = {}
+Accumulator.__index = Accumulator
+
+setmetatable(
+   Accumulator, {
+      __call =
+         function(self, ...)
+            return Accumulator.new(...)
+         end
+   }
+)
+
+local function newproxygc(func)
+   local proxy
+   if newproxy then -- 5.1
+      proxy = newproxy(true)
+      getmetatable(proxy).__gc = func
+   else -- 5.2
+      proxy = {}
+      setmetatable(proxy, {__gc=func})
+   end
+   return proxy
+end
+
+-- the tensor, stripes and mutexes of each accumulator in this thread
+local attached = setmetatable({}, {__mode='k'})
+
+local function attach(self, tensor, mutexes)
+   local n = tensor:nElement()
+   local flat = tensor:view(n)
+   local len = math.ceil(n/#mutexes)
+   local stripes = {}
+   for s=1,#mutexes do
+      local first = (s-1)*len + 1
+      stripes[s] = {first, math.min(len, n - first + 1)}
+   end
+   attached[self] = {
+      tensor = tensor,
+      flat = flat,
+      stripes = stripes,
+      mutexes = mutexes,
+      next = (__threadid or 0) % #mutexes, -- spreads the threads over the stripes
+      proxy = newproxygc(
+         function()
+            for _, mutex in ipairs(mutexes) do
+               mutex:free()
+            end
+         end
+      )
+   }
+   return self
+end
+
+-- Accumulator(acc) attaches to an existing accumulator (in any thread);
+-- otherwise, makes one for tensor (contiguous), split in (at most) stripes
+-- stripes (16 by default)
+function Accumulator.new(tensor, stripes)
+   local torch = require 'torch'
+   if type(tensor) == 'table' then
+      local acc = tensor
+      local self = setmetatable({pointer=acc.pointer, typename=acc.typename, mutexids=acc.mutexids}, Accumulator)
+      tensor = torch.pushudata(acc.pointer, acc.typename)
+      tensor:retain() -- the reference of this thread, released with tensor
+      local mutexes = {}
+      for s, id in ipairs(acc.mutexids) do
+         mutexes[s] = clib.Mutex(id)
+      end
+      return attach(self, tensor, mutexes)
+   end
+   assert(torch.isTensor(tensor), 'tensor expected')
+   assert(tensor:isContiguous(), 'contiguous tensor expected')
+   assert(tensor:nElement() > 0, 'non-empty tensor expected')
+   local n = tensor:nElement()
+   stripes = stripes or 16
+   assert(type(stripes) == 'number' and stripes >= 1, 'positive number of stripes expected')
+   stripes = math.ceil(n/math.ceil(n/math.min(stripes, n))) -- none empty
+   local self = setmetatable({pointer=torch.pointer(tensor), typename=torch.typename(tensor), mutexids={}}, Accumulator)
+   local mutexes = {}
+   for s=1,stripes do
+      mutexes[s] = clib.Mutex()
+      self.mutexids[s] = mutexes[s]:id()
+   end
+   return attach(self, tensor, mutexes)
+end
+
+-- the shared tensor
+function Accumulator:tensor()
+   return attached[self].tensor
+end
+
+-- adds scale (1 by default) times src (of the same number of elements as
+-- the shared tensor) to the shared tensor, one stripe at a time
+function Accumulator:add(src, scale)
+   local acc = attached[self]
+   scale = scale or 1
+   assert(src:nElement() == acc.flat:nElement(), 'inconsistent number of elements')
+   src = src:contiguous():view(acc.flat:nElement())
+   local nstripe = #acc.stripes
+   local s = acc.next
+   acc.next = (acc.next + 1) % nstripe
+   for _=1,nstripe do
+      local first, len = acc.stripes[s+1][1], acc.stripes[s+1][2]
+      local mutex = acc.mutexes[s+1]
+      mutex:lock()
+      acc.flat:narrow(1, first, len):add(scale, src:narrow(1, first, len))
+      mutex:unlock()
+      s = (s + 1) % nstripe
+   end
+end
+
+-- calls func(stripe), with stripe the part of the shared tensor (flattened)
+-- of each stripe, while holding its mutex (e.g. to copy the shared tensor)
+function Accumulator:apply(func)
+   local acc = attached[self]
+   for s, stripe in ipairs(acc.stripes) do
+      local mutex = acc.mutexes[s]
+      mutex:lock()
+      local status, err = pcall(func, acc.flat:narrow(1, stripe[1], stripe[2]))
+      mutex:unlock()
+      if not status then
+         error(err, 0)
+      end
+   end
+end
+
+return Accumulator
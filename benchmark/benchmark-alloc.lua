@@ -0,0 +1,79 @@
+-- Memory footprint of a long run of small jobs: job storages are recycled
+-- by the queues, so the resident size should stay flat once the pool is
+-- warm, instead of growing with the garbage left to the collector.
+-- Buffers allocated per job are the misses of the buffer pools (see
+-- Queue:stats()); non-flat arguments are serialized into a new storage for
+-- each job, which these do not count.
+--    luajit benchmark-alloc.lua [number of jobs] [number of threads]
+-- (resident size is read from /proc/self/statm, i.e. on Linux only)
+
+local threads = require 'threads'
+require 'torch'
+
+local njob = tonumber(arg and arg[1]) or 1000000
+local N = tonumber(arg and arg[2]) or 4
+local nstep = 10
+
+local function rss()
+   local f = io.open('/proc/self/statm')
+   if not f then
+      return 0
+   end
+   local _, resident = f:read('*n', '*n')
+   f:close()
+   return resident*4/1024 -- assumes 4KB pages
+end
+
+-- buffers allocated so far by the queues of pool (nil if not counted)
+local function nallocated(pool)
+   local stats = pool.stats and pool:stats()
+   if stats and stats.jobs.nallocated then
+      return stats.jobs.nallocated + stats.results.nallocated
+   end
+end
+
+local function job(x, name)
+   return x+1, name
+end
+
+-- flat arguments (natively encoded), and a table (serialized)
+local args = {
+   flat = function(i) return i, 'job' end,
+   table = function(i) return i, {'job'} end,
+}
+
+print(string.format('# %d jobs, %d threads', njob, N))
+print('args\tcache\tjobs/s\tRSS start (MB)\tRSS end (MB)\tRSS max (MB)\tbuffers/job')
+
+for _, kind in ipairs{'flat', 'table'} do
+   for _, cache in ipairs{false, true} do
+      local pool = threads.Threads(N, {cache=cache})
+      local done = function() end
+      local arg = args[kind]
+
+      -- warm up the pools
+      for i=1,10000 do
+         pool:addjob(job, done, arg(i))
+      end
+      pool:synchronize()
+      collectgarbage()
+
+      local start = rss()
+      local max = start
+      local allocated = nallocated(pool)
+      local timer = torch.Timer()
+      for step=1,nstep do
+         for i=1,njob/nstep do
+            pool:addjob(job, done, arg(i))
+         end
+         pool:synchronize()
+         max = math.max(max, rss())
+      end
+      local t = timer:time().real
+      local stop = rss()
+      local perjob = allocated and string.format('%.4f', (nallocated(pool) - allocated)/njob) or '-'
+
+      print(string.format('%s\t%s\t%.0f\t%.1f\t%.1f\t%.1f\t%s', kind, cache, njob/t, start, stop, max, perjob))
+      pool:terminate()
+   end
+end
@@ -0,0 +1,36 @@
+-- Cost of encoding and decoding typical job arguments: the native encoding
+-- of flat argument tables versus the generic serializer.
+--    luajit benchmark-args.lua [number of iterations]
+
+local Queue = require 'threads.queue'
+local serialize = require 'threads.serialize'
+require 'torch'
+
+local niter = tonumber(arg and arg[1]) or 100000
+
+local cases = {
+   {'3 numbers', {n=3, 1, 2, 3}},
+   {'index + name', {n=2, 42, 'train'}},
+   {'8 mixed', {n=8, 1, 2.5, true, false, 'a', 'bb', 3, 4}},
+}
+
+print(string.format('# %d iterations', niter))
+print('arguments\tgeneric (us)\tnative (us)')
+
+for _, case in ipairs(cases) do
+   local name, args = case[1], case[2]
+
+   local timer = torch.Timer()
+   for i=1,niter do
+      serialize.load(serialize.save(args))
+   end
+   local generic = timer:time().real
+
+   timer = torch.Timer()
+   for i=1,niter do
+      Queue.unpackargs(Queue.packargs(args))
+   end
+   local native = timer:time().real
+
+   print(string.format('%s\t%.2f\t%.2f', name, generic/niter*1e6, native/niter*1e6))
+end
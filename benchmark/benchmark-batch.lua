@@ -0,0 +1,44 @@
+-- Per-job overhead of Threads:addjob versus Threads:addjobs batches.
+--    luajit benchmark-batch.lua [number of jobs] [number of threads]
+
+local threads = require 'threads'
+require 'torch'
+
+local njob = tonumber(arg and arg[1]) or 100000
+local nthread = tonumber(arg and arg[2]) or 4
+local batchsizes = {1, 2, 4, 8, 16, 32, 64, 128, 256}
+
+local pool = threads.Threads(nthread)
+
+local job = function(i) return i end
+local ndone = 0
+local done = function() ndone = ndone + 1 end
+
+print(string.format('# %d empty jobs, %d threads', njob, nthread))
+print('batch\tus/job')
+
+-- reference: one addjob per job
+local timer = torch.Timer()
+for i=1,njob do
+   pool:addjob(job, done, i)
+end
+pool:synchronize()
+print(string.format('addjob\t%.2f', timer:time().real*1e6/njob))
+
+for _, batchsize in ipairs(batchsizes) do
+   ndone = 0
+   timer:reset()
+   local jobs = {}
+   for i=1,njob do
+      table.insert(jobs, {job, done, i})
+      if #jobs == batchsize or i == njob then
+         pool:addjobs(jobs)
+         jobs = {}
+      end
+   end
+   pool:synchronize()
+   assert(ndone == njob)
+   print(string.format('%d\t%.2f', batchsize, timer:time().real*1e6/njob))
+end
+
+pool:terminate()
@@ -0,0 +1,323 @@
+-- Micro-benchmarks of the threading core, with a JSON report (to compare
+-- releases). Sections:
+--  * throughput: empty jobs per second through a pool, versus its size;
+--  * latency: round trip of a single empty job, versus the pool size;
+--  * serialize: cost of sending arguments (save and load), versus their
+--    type and size, for threads.serialize and threads.sharedserialize;
+--  * handoff: time to wake up another thread with a condition (and a
+--    mutex), and with a semaphore;
+--  * startup: time to create (and terminate) a pool, versus its size, with
+--    fresh threads and with threads of the global pool;
+--  * specific: throughput of specific versus shared mode.
+--    luajit benchmark-core.lua [section ...] [scale=x] [threads=n] [output=file]
+-- The default is every section, with 1 to 8 threads; scale multiplies the
+-- number of iterations. The report goes to the output file, or stdout.
+
+local threads = require 'threads'
+require 'torch'
+
+local now = threads.now
+
+local options = {scale=1, threads=8}
+local sections = {}
+for _, a in ipairs(arg or {}) do
+   local key, value = a:match('^(%w+)=(.*)$')
+   if key then
+      options[key] = tonumber(value) or value
+   else
+      sections[a] = true
+   end
+end
+if not next(sections) then
+   sections = nil -- all of them
+end
+
+local function iterations(n)
+   return math.max(math.floor(n*options.scale), 1)
+end
+
+local function poolsizes()
+   local sizes = {}
+   local N = 1
+   while N <= options.threads do
+      table.insert(sizes, N)
+      N = 2*N
+   end
+   return sizes
+end
+
+local function log(fmt, ...)
+   io.stderr:write(string.format(fmt, ...) .. '\n')
+end
+
+local benchmarks = {}
+local order = {}
+
+local function benchmark(name, func)
+   table.insert(order, name)
+   benchmarks[name] = func
+end
+
+benchmark('throughput', function()
+   local results = {}
+   local njob = iterations(100000)
+   for _, N in ipairs(poolsizes()) do
+      local pool = threads.Threads(N)
+      local t = now()
+      for i=1,njob do
+         pool:addjob(function() end)
+      end
+      pool:synchronize()
+      t = now() - t
+      pool:terminate()
+      table.insert(results, {threads=N, jobs=njob, jobs_per_second=njob/t})
+      log('throughput\t%d threads\t%.0f jobs/s', N, njob/t)
+   end
+   return results
+end)
+
+benchmark('latency', function()
+   local results = {}
+   local njob = iterations(10000)
+   for _, N in ipairs(poolsizes()) do
+      local pool = threads.Threads(N)
+      local t = now()
+      for i=1,njob do
+         pool:addjob(function() end)
+         pool:dojob()
+      end
+      t = now() - t
+      pool:terminate()
+      table.insert(results, {threads=N, jobs=njob, roundtrip_us=t/njob*1e6})
+      log('latency\t%d threads\t%.1f us', N, t/njob*1e6)
+   end
+   return results
+end)
+
+benchmark('serialize', function()
+   local results = {}
+   local kinds = {
+      numbers = function(n)
+         local args = {}
+         for i=1,n do
+            args[i] = i
+         end
+         return args
+      end,
+      string = function(n)
+         return {string.rep('x', n)}
+      end,
+      tensor = function(n)
+         return {torch.FloatTensor(n):fill(1)}
+      end
+   }
+   for _, package in ipairs{'threads.serialize', 'threads.sharedserialize'} do
+      local serialize = require(package)
+      for _, kind in ipairs{'numbers', 'string', 'tensor'} do
+         for _, size in ipairs{16, 1024, 65536} do
+            local args = kinds[kind](size)
+            local niter = iterations(kind == 'numbers' and 1e7/(size+100) or 1e8/(size+1000))
+            local t = now()
+            for i=1,niter do
+               serialize.load(serialize.save(args))
+            end
+            t = now() - t
+            table.insert(results, {serialization=package, kind=kind, size=size, iterations=niter,
+                                   us=t/niter*1e6})
+            log('serialize\t%s\t%s\t%d\t%.2f us', package, kind, size, t/niter*1e6)
+         end
+      end
+   end
+   return results
+end)
+
+-- ping-pong between the main thread and another thread, which answers each
+-- ping; returns the time of a single handoff (half a round trip)
+local function pingpong(niter, ping, code)
+   local thread = threads.Thread(code)
+   local t = now()
+   ping(niter)
+   t = now() - t
+   thread:free()
+   return t/(2*niter)
+end
+
+benchmark('handoff', function()
+   local niter = iterations(20000)
+   local results = {}
+
+   -- turn[1]: 0 for the main thread, 1 for the other one, 2 to stop
+   local mutex = threads.Mutex()
+   local cond = threads.Condition()
+   local turn = torch.IntStorage(1):fill(0)
+   local condition = pingpong(
+      niter,
+      function(niter)
+         mutex:lock()
+         for i=1,niter do
+            turn[1] = 1
+            cond:signal()
+            while turn[1] == 1 do
+               cond:wait(mutex)
+            end
+         end
+         turn[1] = 2
+         cond:signal()
+         mutex:unlock()
+      end,
+      string.format([[
+         local threads = require 'threads'
+         require 'torch'
+         local mutex = threads.Mutex(%d)
+         local cond = threads.Condition(%d)
+         local turn = torch.pushudata(%d, 'torch.IntStorage')
+         turn:retain()
+         mutex:lock()
+         while true do
+            while turn[1] == 0 do
+               cond:wait(mutex)
+            end
+            if turn[1] == 2 then
+               break
+            end
+            turn[1] = 0
+            cond:signal()
+         end
+         mutex:unlock()
+      ]], mutex:id(), cond:id(), torch.pointer(turn)))
+   mutex:free()
+   cond:free()
+   table.insert(results, {primitive='condition', iterations=niter, us=condition*1e6})
+   log('handoff\tcondition\t%.2f us', condition*1e6)
+
+   local ping = threads.Semaphore()
+   local pong = threads.Semaphore()
+   local semaphore = pingpong(
+      niter,
+      function(niter)
+         for i=1,niter do
+            ping:post()
+            pong:wait()
+         end
+      end,
+      string.format([[
+         local threads = require 'threads'
+         local ping = threads.Semaphore(%d)
+         local pong = threads.Semaphore(%d)
+         for i=1,%d do
+            ping:wait()
+            pong:post()
+         end
+      ]], ping:id(), pong:id(), niter))
+   ping:free()
+   pong:free()
+   table.insert(results, {primitive='semaphore', iterations=niter, us=semaphore*1e6})
+   log('handoff\tsemaphore\t%.2f us', semaphore*1e6)
+
+   return results
+end)
+
+-- a pool whose threads load torch, with fresh threads, and with threads
+-- leased from the global pool (warmed up by the first iteration)
+benchmark('startup', function()
+   local results = {}
+   local niter = iterations(20)
+   for _, N in ipairs(poolsizes()) do
+      for _, global in ipairs{false, true} do
+         local start, stop = 0, 0
+         for i=1,niter do
+            local t = now()
+            local pool = threads.Threads(N, {global=global}, function() require 'torch' end)
+            start = start + now() - t
+            t = now()
+            pool:terminate()
+            stop = stop + now() - t
+         end
+         local mode = global and 'global' or 'fresh'
+         table.insert(results, {threads=N, mode=mode, iterations=niter, start_ms=start/niter*1e3,
+                                terminate_ms=stop/niter*1e3})
+         log('startup\t%d threads\t%s\t%.2f ms\t%.2f ms', N, mode, start/niter*1e3, stop/niter*1e3)
+      end
+   end
+   threads.Threads.shutdown()
+   return results
+end)
+
+benchmark('specific', function()
+   local results = {}
+   local njob = iterations(100000)
+   for _, N in ipairs(poolsizes()) do
+      local pool = threads.Threads(N)
+      for _, specific in ipairs{false, true} do
+         pool:specific(specific)
+         local t = now()
+         for i=1,njob do
+            if specific then
+               pool:addjob(i % N + 1, function() end)
+            else
+               pool:addjob(function() end)
+            end
+         end
+         pool:synchronize()
+         t = now() - t
+         table.insert(results, {threads=N, mode=specific and 'specific' or 'shared', jobs=njob,
+                                jobs_per_second=njob/t})
+         log('specific\t%d threads\t%s\t%.0f jobs/s', N, specific and 'specific' or 'shared', njob/t)
+      end
+      pool:terminate()
+   end
+   return results
+end)
+
+-- JSON encoding (keys sorted, for stable reports)
+local function json(obj, indent)
+   indent = indent or ''
+   local t = type(obj)
+   if t == 'number' then
+      if obj ~= obj or obj == math.huge or obj == -math.huge then
+         return 'null'
+      end
+      return obj == math.floor(obj) and string.format('%d', obj) or string.format('%.6g', obj)
+   elseif t == 'string' then
+      return (string.format('%q', obj):gsub('\\\n', '\\n'))
+   elseif t == 'boolean' then
+      return tostring(obj)
+   elseif t == 'table' then
+      local inner = indent .. '  '
+      local items = {}
+      if #obj > 0 or next(obj) == nil then
+         for _, v in ipairs(obj) do
+            table.insert(items, inner .. json(v, inner))
+         end
+         return '[\n' .. table.concat(items, ',\n') .. '\n' .. indent .. ']'
+      end
+      local keys = {}
+      for k in pairs(obj) do
+         table.insert(keys, k)
+      end
+      table.sort(keys)
+      for _, k in ipairs(keys) do
+         table.insert(items, string.format('%s"%s": %s', inner, k, json(obj[k], inner)))
+      end
+      return '{\n' .. table.concat(items, ',\n') .. '\n' .. indent .. '}'
+   end
+   return 'null'
+end
+
+local report = {
+   date = os.date('!%Y-%m-%dT%H:%M:%SZ'),
+   lua = jit and jit.version or _VERSION,
+   scale = options.scale,
+   results = {}
+}
+for _, name in ipairs(order) do
+   if not sections or sections[name] then
+      report.results[name] = benchmarks[name]()
+   end
+end
+
+local output = options.output and assert(io.open(options.output, 'w')) or io.stdout
+output:write(json(report) .. '\n')
+if options.output then
+   output:close()
+end
@@ -0,0 +1,49 @@
+-- Per-job latency of small jobs, with and without the callback cache.
+--
+-- "round trip" is one job at a time (addjob, then dojob), "pipelined" is
+-- the cost per job when many jobs are in flight.
+--    luajit benchmark-latency.lua [number of jobs] [number of threads]
+
+local threads = require 'threads'
+require 'torch'
+
+local njob = tonumber(arg and arg[1]) or 20000
+local N = tonumber(arg and arg[2]) or 4
+
+-- a callback doing a little work, with a few arguments
+local function job(x, y, name)
+   local s = 0
+   for i=1,10 do
+      s = s + x*i + y
+   end
+   return s, name
+end
+
+print(string.format('# %d jobs, %d threads', njob, N))
+print('cache\tround trip (us)\tpipelined (us)')
+
+for _, cache in ipairs{false, true} do
+   local pool = threads.Threads(N, {cache=cache})
+
+   local ndone = 0
+   local done = function() ndone = ndone + 1 end
+
+   local timer = torch.Timer()
+   for i=1,njob do
+      pool:addjob(job, done, i, 2, 'job')
+      pool:dojob()
+   end
+   local roundtrip = timer:time().real
+
+   timer = torch.Timer()
+   for i=1,njob do
+      pool:addjob(job, done, i, 2, 'job')
+   end
+   pool:synchronize()
+   local pipelined = timer:time().real
+
+   assert(ndone == 2*njob)
+   print(string.format('%s\t%.1f\t%.1f', cache, roundtrip/njob*1e6, pipelined/njob*1e6))
+
+   pool:terminate()
+end
@@ -0,0 +1,78 @@
+-- Plain versus adaptive (spin then park) mutexes, under contention:
+--  * lock: N threads lock and unlock the same mutex, reports the average
+--    time per lock handoff;
+--  * queue: N producers and N consumers share one queue, reports jobs/s.
+-- Adaptive mutexes never spin on a single core machine.
+--    luajit benchmark-mutex.lua [number of iterations] [number of threads]
+
+local threads = require 'threads'
+local Queue = require 'threads.queue'
+require 'torch'
+
+local niter = tonumber(arg and arg[1]) or 100000
+local N = tonumber(arg and arg[2]) or 4
+
+-- runs code (formatted with ...) in n threads, once they are all started
+-- (index is the index of the thread in the code)
+local function run(n, code, ...)
+   local ready = threads.Semaphore()
+   local go = threads.Semaphore()
+   local workers = {}
+   for i=1,n do
+      workers[i] = threads.Thread(string.format([[
+         local threads = require 'threads'
+         local Queue = require 'threads.queue'
+         local index = %d
+         local ready = threads.Semaphore(%d)
+         local go = threads.Semaphore(%d)
+         ready:post()
+         go:wait()
+      ]], i, ready:id(), go:id()) .. string.format(code, ...))
+   end
+   for i=1,n do
+      ready:wait()
+   end
+   local timer = torch.Timer()
+   go:post(n)
+   for i=1,n do
+      workers[i]:free()
+   end
+   local t = timer:time().real
+   ready:free()
+   go:free()
+   return t
+end
+
+print(string.format('# %d iterations, %d threads', niter, N))
+print('mutex\tspins\tlock (ns)\tqueue (jobs/s)')
+
+for _, adaptive in ipairs{false, true} do
+   local mutex = threads.Mutex({adaptive=adaptive})
+   local tlock = run(N, [[
+      local mutex = threads.Mutex(%d)
+      for i=1,%d do
+         mutex:lock()
+         mutex:unlock()
+      end
+   ]], mutex:id(), niter)
+
+   local queue = Queue(N, 'threads.sharedserialize', {adaptive=adaptive})
+   local tqueue = run(2*N, [[
+      local queue = Queue(%d)
+      local function job() end
+      if index <= %d then
+         for i=1,%d do
+            queue:addjobpacked(job, {}, true)
+         end
+      else
+         for i=1,%d do
+            queue:dojob()
+         end
+      end
+   ]], queue:id(), N, niter, niter)
+
+   print(string.format('%s\t%s\t%.0f\t%.0f',
+                       adaptive and 'adaptive' or 'plain', mutex:isadaptive(),
+                       tlock/(N*niter)*1e9, N*niter/tqueue))
+   mutex:free()
+end
@@ -0,0 +1,51 @@
+-- Cost per element of a parallel loop (a sum of square roots): plain loop
+-- on the main thread, one job per element, one job per chunk of elements
+-- (Threads:parallelFor), and Threads:mapReduce.
+--    luajit benchmark-parallelfor.lua [number of elements] [number of threads]
+
+local threads = require 'threads'
+
+local n = tonumber(arg and arg[1]) or 1000000
+local N = tonumber(arg and arg[2]) or 4
+local now = threads.now
+
+local function map(i)
+   return math.sqrt(i)
+end
+
+local function add(a, b)
+   return a + b
+end
+
+print(string.format('# %d elements, %d threads', n, N))
+print('loop\tns/element')
+
+local t = now()
+local sum = 0
+for i=1,n do
+   sum = sum + map(i)
+end
+print(string.format('plain\t%.1f', (now()-t)/n*1e9))
+
+local pool = threads.Threads(N)
+
+-- one job per element is much slower: only a fraction of the elements
+local njob = math.min(n, 20000)
+t = now()
+local jobsum = 0
+for i=1,njob do
+   pool:addjob(map, function(x) jobsum = jobsum + x end, i)
+end
+pool:synchronize()
+print(string.format('addjob\t%.1f', (now()-t)/njob*1e9))
+
+t = now()
+pool:parallelFor(1, n, function(i) return math.sqrt(i) end)
+print(string.format('parallelFor\t%.1f', (now()-t)/n*1e9))
+
+t = now()
+local reduced = pool:mapReduce({1, n}, map, add)
+print(string.format('mapReduce\t%.1f', (now()-t)/n*1e9))
+assert(math.abs(reduced - sum) < 1e-6*sum)
+
+pool:terminate()
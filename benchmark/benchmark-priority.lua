@@ -0,0 +1,47 @@
+-- Latency of urgent jobs (time from addjob to the start of the job) while
+-- the pool is saturated with background jobs, with a single FIFO queue and
+-- with two priority lanes.
+--    luajit benchmark-priority.lua [number of urgent jobs] [number of threads] [background job (ms)]
+
+local threads = require 'threads'
+
+local nurgent = tonumber(arg and arg[1]) or 200
+local N = tonumber(arg and arg[2]) or 4
+local duration = (tonumber(arg and arg[3]) or 2)/1000
+local now = threads.now
+
+local function background(duration)
+   local now = require('threads').now
+   local t = now()
+   while now() - t < duration do
+   end
+end
+
+local function urgent()
+   return require('threads').now()
+end
+
+local function percentile(values, p)
+   table.sort(values)
+   return values[math.max(math.ceil(#values*p), 1)]
+end
+
+print(string.format('# %d urgent jobs, %d threads, background jobs of %.1f ms', nurgent, N, duration*1000))
+print('lanes\tp50 (ms)\tp99 (ms)\tmax (ms)')
+
+for _, priorities in ipairs{1, 2} do
+   local pool = threads.Threads(N, {priorities=priorities})
+   local latencies = {}
+   for i=1,nurgent do
+      for j=1,4 do -- keeps the background lane full
+         pool:addjob(1, background, nil, duration)
+      end
+      local submitted = now()
+      pool:addjob(priorities, urgent, function(started) table.insert(latencies, started - submitted) end)
+   end
+   pool:synchronize()
+   pool:terminate()
+   print(string.format('%d\t%.2f\t%.2f\t%.2f', priorities,
+                       percentile(latencies, 0.5)*1000, percentile(latencies, 0.99)*1000,
+                       percentile(latencies, 1)*1000))
+end
@@ -0,0 +1,34 @@
+-- Queue throughput with tiny jobs, for 1 to 64 worker threads.
+--
+-- Only the public Threads API is used, so the script can be run against
+-- two revisions of the package to compare queue implementations:
+--    luajit benchmark-queue.lua [number of jobs]
+
+local threads = require 'threads'
+require 'torch'
+
+local njob = tonumber(arg and arg[1]) or 100000
+local nthreads = {1, 2, 4, 8, 16, 32, 64}
+
+print(string.format('# %d empty jobs per run', njob))
+print('threads\tjobs/s')
+
+for _, N in ipairs(nthreads) do
+   local pool = threads.Threads(N)
+
+   local job = function(i) return i end
+   local ndone = 0
+   local done = function() ndone = ndone + 1 end
+
+   local timer = torch.Timer()
+   for i=1,njob do
+      pool:addjob(job, done, i)
+   end
+   pool:synchronize()
+   local elapsed = timer:time().real
+
+   assert(ndone == njob)
+   print(string.format('%d\t%.0f', N, njob/elapsed))
+
+   pool:terminate()
+end
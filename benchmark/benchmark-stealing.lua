@@ -0,0 +1,50 @@
+-- Skewed job durations: one job out of 8 is 50 times longer than the others.
+--
+-- Compares the three ways of scheduling jobs over a pool: the shared
+-- queue, specific queues (jobs assigned round-robin) and work stealing.
+--    luajit benchmark-stealing.lua [number of jobs] [number of threads]
+
+local threads = require 'threads'
+require 'torch'
+
+local njob = tonumber(arg and arg[1]) or 2000
+local N = tonumber(arg and arg[2]) or 4
+
+local function job(n)
+   local x = 0
+   for i=1,n do
+      x = x + i % 7
+   end
+   return x
+end
+
+local function cost(i)
+   return (i % 8 == 0) and 500000 or 10000
+end
+
+print(string.format('# %d jobs, %d threads', njob, N))
+print('mode\ttime (s)')
+
+for _, mode in ipairs{'shared', 'specific', 'stealing'} do
+   local pool = threads.Threads(N, {stealing=(mode == 'stealing')})
+   pool:specific(mode == 'specific')
+
+   local ndone = 0
+   local done = function() ndone = ndone + 1 end
+
+   local timer = torch.Timer()
+   for i=1,njob do
+      if mode == 'specific' then
+         pool:addjob(i % N + 1, job, done, cost(i))
+      else
+         pool:addjob(job, done, cost(i))
+      end
+   end
+   pool:synchronize()
+   local elapsed = timer:time().real
+
+   assert(ndone == njob)
+   print(string.format('%s\t%.3f', mode, elapsed))
+
+   pool:terminate()
+end
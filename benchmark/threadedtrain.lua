@@ -20,6 +20,7 @@ local function threadedTrain(module, criterion, data, label, params)
    Threads.serialization('threads.sharedserialize')
    local threads = Threads(
       params.threads,
+      {cache=true}, -- the same update callback is sent for every batch
       function()
          require 'nn'
       end,
@@ -73,15 +74,16 @@ local function threadedTrain(module, criterion, data, label, params)
    )
 
    local weights = module:parameters()
+   local function update(idx)
+      return gupdate(idx)
+   end
    for iter=1,params.iter do
       local totalerr = 0
       local idx = 1
       while idx < label:size(1)/params.batch do
 
          threads:addjob(
-            function(idx)
-               return gupdate(idx)
-            end,
+            update,
 
             function(err, dweights)
                totalerr = totalerr + err
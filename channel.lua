@@ -0,0 +1,155 @@
+-- Bounded channels, between any threads (the queue threads of pools
+-- included), which attach to a channel by id. A channel is a queue whose
+-- jobs give back their arguments: messages are encoded like the arguments
+-- of jobs.
+
+local Queue = require 'threads.queue'
+local _unpack = unpack or table.unpack
+
+local Channel = {}
+Channel.__index = Channel
+
+setmetatable(
+   Channel, {
+      __call =
+         function(self, ...)
+            return Channel.new(...)
+         end
+   }
+)
+
+-- the job of every message (serialized once per channel user)
+local function message(...)
+   return {n=select('#', ...), ...}
+end
+
+-- the types of the messages of a channel, from the info of its queue
+local function parsetypes(info)
+   if info then
+      local types = {}
+      for name in info:gmatch('[^,]+') do
+         table.insert(types, name)
+      end
+      return types
+   end
+end
+
+-- options are size (number of messages, 1 by default), serialize (the
+-- serialization package, threads.serialize by default), types (the
+-- type of each value of a message, checked when it is sent) and growable
+-- (the channel doubles its size instead of being full)
+function Channel.new(options)
+   assert(options == nil or type(options) == 'table',
+          'table of options expected (see Channel.attach() for channel ids)')
+   options = options or {}
+   local size = options.size or 1
+   assert(type(size) == 'number' and size >= 1, 'positive channel size expected')
+   local info
+   if options.types then
+      assert(type(options.types) == 'table' and #options.types > 0, 'table of type names expected')
+      for _, name in ipairs(options.types) do
+         assert(type(name) == 'string' and name ~= '' and not name:find(','), 'type name expected')
+      end
+      info = table.concat(options.types, ',')
+   end
+   local queue = Queue(size, options.serialize or 'threads.serialize', {info=info, growable=options.growable})
+   return setmetatable({queue=queue, signature=parsetypes(info)}, Channel)
+end
+
+-- attaches to the existing channel of the given id (see Channel:id())
+function Channel.attach(id)
+   assert(type(id) == 'number', 'channel id expected')
+   local queue = Queue(id)
+   return setmetatable({queue=queue, signature=parsetypes(queue.info)}, Channel)
+end
+
+function Channel:id()
+   return self.queue:id()
+end
+
+-- the type names of the values of a message, nil if untyped
+function Channel:types()
+   return self.signature
+end
+
+local function typename(value)
+   local torch = package.loaded.torch
+   return (torch and torch.typename(value)) or type(value)
+end
+
+local function pack(self, ...)
+   local n = select('#', ...)
+   assert(n > 0, 'at least one value expected')
+   local types = self.signature
+   if types then
+      assert(n == #types, string.format('%d values expected, got %d', #types, n))
+      for i=1,n do
+         local name = typename((select(i, ...)))
+         assert(types[i] == '*' or name == types[i],
+                string.format('%s expected for value %d, got %s', types[i], i, name))
+      end
+   end
+   return {n=n, ...}
+end
+
+-- sends a message (the given values), waiting for room if the channel is
+-- full; raises an error if the channel is closed
+function Channel:send(...)
+   if not self.queue:addjobpacked(message, pack(self, ...), true) then
+      error('channel closed', 2)
+   end
+end
+
+-- sends a message if the channel has room; returns false otherwise
+function Channel:trysend(...)
+   local pushed = self.queue:tryaddjobpacked(message, pack(self, ...), true)
+   if pushed == nil then
+      error('channel closed', 2)
+   end
+   return pushed
+end
+
+-- returns the values of the next message, waiting for it at most timeout
+-- seconds (if given); returns nothing if none came, or if the channel is
+-- closed and empty
+function Channel:recv(timeout)
+   local values = self.queue:dojob(timeout)
+   if values then
+      return _unpack(values, 1, values.n)
+   end
+end
+
+-- like recv(), without waiting
+function Channel:tryrecv()
+   return self:recv(0)
+end
+
+-- messages cannot be sent anymore; the ones already sent can still be
+-- received, then recv() returns nothing instead of waiting
+function Channel:close()
+   self.queue:close()
+end
+
+function Channel:isclosed()
+   return self.queue.isclosed == 1
+end
+
+local nselect = 0
+
+-- waits for a message on any of the channels, at most timeout seconds (if
+-- given); returns the index of its channel, then its values, or nothing if
+-- none came, or if all the channels are closed and empty
+function Channel.select(channels, timeout)
+   assert(type(channels) == 'table' and #channels > 0, 'table of channels expected')
+   local queues = {}
+   for i, channel in ipairs(channels) do
+      queues[i] = channel.queue
+   end
+   nselect = nselect + 1 -- the channel looked at first, in turn
+   local idx, values = Queue.selectjob(queues, (nselect-1) % #queues + 1, timeout)
+   if idx then
+      return idx, _unpack(values, 1, values.n)
+   end
+end
+
+return Channel
@@ -4,9 +4,19 @@ local C = require 'libthreads'
 
 threads.Thread = C.Thread
 threads.Mutex = C.Mutex
+threads.RWLock = C.RWLock
 threads.Condition = C.Condition
+threads.Semaphore = C.Semaphore
+threads.Barrier = C.Barrier
+threads.Atomic = C.Atomic
+threads.now = C.now
 threads.Threads = require 'threads.threads'
 threads.safe = require 'threads.safe'
+threads.Channel = require 'threads.channel'
+threads.select = threads.Channel.select
+threads.Pipeline = require 'threads.pipeline'
+threads.Prefetch = require 'threads.prefetch'
+threads.Accumulator = require 'threads.accumulator'
 
 -- only for backward compatibility (boo)
 setmetatable(threads, getmetatable(threads.Threads))
@@ -0,0 +1,858 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TH.h"
+#include "THQueue.h"
+
+/*
+  Bounded multi-producer/multi-consumer ring (D. Vyukov's design).
+
+  Each slot carries a sequence number. A slot is free for the producer
+  owning position pos when seq == pos, and holds a job for the consumer
+  owning position pos when seq == pos+1. Producers and consumers claim
+  positions with a CAS on enqueuepos/dequeuepos, so no lock is taken
+  while the ring is neither full nor empty. The mutex and the conditions
+  are only used to park a thread when it cannot make progress.
+
+  Positions wrap around as unsigned longs, hence the power-of-two
+  capacity. A single slot cannot tell "filled at pos" from "free at
+  pos+1", so the capacity is at least 2.
+
+  With THQUEUE_SPSC, there is a single producer and a single consumer:
+  each side owns its position and advances it without a CAS.
+
+  A thread waiting on several queues at once (THQueue_select) registers
+  a THQueueWaiter on each of them. A producer rings (and unregisters)
+  one registered waiter which has not been rung yet after each push.
+  The waiter then polls all its queues again before going back to
+  sleep. If it returns with an item while it has been rung, the wakeup
+  might have been meant for another item: it is passed on to the
+  queues which are still not empty.
+
+  With THQUEUE_GROWABLE, the queue is never full: a producer which finds
+  the ring full moves its jobs into a ring twice as large. Positions are
+  kept, so that a job stays at pos & mask in the new ring. The ring is
+  then accessed under its own lock (growmutex), taken after the queue
+  mutex when both are needed. The buffers ring (see below) grows with it,
+  under the same lock.
+
+  A closed queue wakes up all its producers, consumers (and select
+  waiters). Pushes then fail with THQUEUE_CLOSED; pops return
+  THQUEUE_CLOSED instead of waiting once the queue is empty. Close first
+  sets closing, then waits for the pushes which might have missed it
+  (counted in npushing) to land before setting closed, so that a message
+  is never left behind in a queue seen as closed and empty.
+
+  Job storages are recycled in a second ring of the same kind, so that
+  steady job traffic does not allocate: producers take their buffers
+  from it, and consumers give them back once they are read. Buffers only
+  grow; too large ones are not kept.
+*/
+
+#define THQUEUE_CACHELINE 64
+#define THQUEUE_MAXBUFFER 65536
+
+#define THQueue_add(pos, n) ((long)((unsigned long)(pos) + (unsigned long)(n)))
+#define THQueue_diff(a, b) ((long)((unsigned long)(a) - (unsigned long)(b)))
+
+typedef struct THQueueSlot_ {
+  long seq;
+  THCharStorage *callback;
+  THCharStorage *arg;
+} THQueueSlot;
+
+struct THQueueWaiter_ {
+  THMutex *mutex;
+  THCondition *cond;
+  int signaled;
+};
+
+typedef struct THQueueRing_ {
+  long enqueuepos;
+  char pad0[THQUEUE_CACHELINE-sizeof(long)];
+  long dequeuepos;
+  char pad1[THQUEUE_CACHELINE-sizeof(long)];
+
+  THQueueSlot *slots;
+  long mask;
+  int flags;
+} THQueueRing;
+
+struct THQueue_ {
+  THQueueRing jobs;
+  THQueueRing buffers; /* free storages */
+  int size;
+  THMutex *growmutex; /* growable queues only: guards the jobs and buffers rings */
+
+  THMutex *mutex;
+  THCondition *notfull;
+  THCondition *notempty;
+  int nwaitfull;
+  int nwaitempty;
+
+  /* statistics (see THQueueStats); the wait ones are updated under the mutex */
+  long maxdepth;
+  long nblockedfull;
+  long nblockedempty;
+  double blockedfull;
+  double blockedempty;
+  long nallocated;
+
+  THQueueWaiter **waiters;
+  int nwaiters;
+  int maxwaiters;
+  int nselect;
+  int closing; /* set first by close: pushes fail from then on */
+  int npushing; /* pushes between their check of closing and their enqueue */
+  int closed; /* set once the pushes in flight are done */
+
+  char *serialize;
+  char *info; /* set by the creator, before sharing the queue (NULL if none) */
+  int refcount;
+};
+
+THQueue* THQueue_new(int size, const char *serialize)
+{
+  return THQueue_newWithFlags(size, serialize, 0);
+}
+
+static int THQueue_ringinit(THQueueRing *ring, long capacity, int flags)
+{
+  long i;
+  ring->slots = calloc(capacity, sizeof(THQueueSlot));
+  if(!ring->slots)
+    return 1;
+  for(i = 0; i < capacity; i++)
+    ring->slots[i].seq = i;
+  ring->mask = capacity-1;
+  ring->flags = flags;
+  return 0;
+}
+
+static void THQueue_ringfree(THQueueRing *ring)
+{
+  long i;
+  if(ring->slots) {
+    for(i = 0; i <= ring->mask; i++) {
+      if(ring->slots[i].callback)
+        THCharStorage_free(ring->slots[i].callback);
+      if(ring->slots[i].arg)
+        THCharStorage_free(ring->slots[i].arg);
+    }
+    free(ring->slots);
+  }
+}
+
+THQueue* THQueue_newWithFlags(int size, const char *serialize, int flags)
+{
+  THQueue *self = NULL;
+  size_t serialize_len = strlen(serialize);
+  long capacity = 2;
+
+  if(size < 1)
+    return NULL;
+  while(capacity < size)
+    capacity *= 2;
+
+  self = calloc(1, sizeof(THQueue)); /* zeroed */
+  if(!self)
+    return NULL;
+
+  self->mutex = THMutex_newWithFlags((flags & THQUEUE_ADAPTIVE) ? THMUTEX_ADAPTIVE : 0);
+  self->notfull = THCondition_new();
+  self->notempty = THCondition_new();
+  self->serialize = malloc(serialize_len+1);
+  if(flags & THQUEUE_GROWABLE) {
+    flags &= ~THQUEUE_SPSC; /* the ring is under a lock anyways */
+    self->growmutex = THMutex_new();
+  }
+
+  /* a job holds up to two buffers */
+  if(!self->mutex || !self->notfull || !self->notempty || !self->serialize
+     || ((flags & THQUEUE_GROWABLE) && !self->growmutex)
+     || THQueue_ringinit(&self->jobs, capacity, flags)
+     || THQueue_ringinit(&self->buffers, 2*capacity, flags)) {
+    THMutex_free(self->mutex);
+    THMutex_free(self->growmutex);
+    THCondition_free(self->notfull);
+    THCondition_free(self->notempty);
+    THQueue_ringfree(&self->jobs);
+    THQueue_ringfree(&self->buffers);
+    free(self->serialize);
+    free(self);
+    return NULL;
+  }
+
+  memcpy(self->serialize, serialize, serialize_len+1);
+  self->size = (int)capacity;
+  self->refcount = 1;
+
+  return self;
+}
+
+THQueue* THQueue_newWithId(AddressType id)
+{
+  THQueue *self = (THQueue*)id;
+  THAtomicIncrementRef(&self->refcount);
+  return self;
+}
+
+AddressType THQueue_id(THQueue *self)
+{
+  return (AddressType)self;
+}
+
+void THQueue_retain(THQueue *self)
+{
+  THAtomicIncrementRef(&self->refcount);
+}
+
+const char* THQueue_serialize(THQueue *self)
+{
+  return self->serialize;
+}
+
+/* copies info, a string describing the queue (e.g. the types of the
+   messages of a channel); to be called before the queue is shared
+   returns 1 if it could not be allocated */
+int THQueue_setinfo(THQueue *self, const char *info)
+{
+  size_t len = strlen(info);
+  char *copy = malloc(len+1);
+  if(!copy)
+    return 1;
+  memcpy(copy, info, len+1);
+  free(self->info);
+  self->info = copy;
+  return 0;
+}
+
+const char* THQueue_info(THQueue *self)
+{
+  return self->info;
+}
+
+int THQueue_size(THQueue *self)
+{
+  return THAtomicGet(&self->size);
+}
+
+long THQueue_head(THQueue *self)
+{
+  return THAtomicGetLong(&self->jobs.dequeuepos) & self->jobs.mask;
+}
+
+long THQueue_tail(THQueue *self)
+{
+  return THAtomicGetLong(&self->jobs.enqueuepos) & self->jobs.mask;
+}
+
+static long THQueue_count(THQueue *self)
+{
+  long head = THAtomicGetLong(&self->jobs.dequeuepos);
+  long tail = THAtomicGetLong(&self->jobs.enqueuepos);
+  long count = THQueue_diff(tail, head);
+  return (count < 0 ? 0 : count);
+}
+
+int THQueue_isempty(THQueue *self)
+{
+  return THQueue_count(self) == 0;
+}
+
+int THQueue_isfull(THQueue *self)
+{
+  if(self->growmutex)
+    return 0;
+  return THQueue_count(self) >= self->size;
+}
+
+THMutex* THQueue_mutex(THQueue *self)
+{
+  return self->mutex;
+}
+
+THCondition* THQueue_notfull(THQueue *self)
+{
+  return self->notfull;
+}
+
+THCondition* THQueue_notempty(THQueue *self)
+{
+  return self->notempty;
+}
+
+/* wake up to n threads parked on cond, if any
+   (the waiter count is bumped before the parked thread re-checks the ring) */
+static void THQueue_wake(THQueue *self, THCondition *cond, int volatile *nwait, int n)
+{
+  int nwaiting = THAtomicGet(nwait);
+  if(nwaiting > 0) {
+    if(n > nwaiting)
+      n = nwaiting;
+    THMutex_lock(self->mutex);
+    while(n-- > 0)
+      THCondition_signal(cond);
+    THMutex_unlock(self->mutex);
+  }
+}
+
+/* ring one thread (or all of them) waiting in THQueue_select on this queue, if any
+   (waiters already rung through another queue are dropped from the list) */
+static void THQueue_ring(THQueue *self, int all)
+{
+  if(THAtomicGet(&self->nselect) > 0) {
+    THMutex_lock(self->mutex);
+    while(self->nwaiters > 0) {
+      THQueueWaiter *waiter = self->waiters[--self->nwaiters];
+      int rung = 0;
+      THAtomicAdd(&self->nselect, -1);
+      THMutex_lock(waiter->mutex);
+      if(!waiter->signaled) {
+        waiter->signaled = 1;
+        THCondition_signal(waiter->cond);
+        rung = 1;
+      }
+      THMutex_unlock(waiter->mutex);
+      if(rung && !all)
+        break;
+    }
+    THMutex_unlock(self->mutex);
+  }
+}
+
+static void THQueue_notify(THQueue *self)
+{
+  THQueue_wake(self, self->notempty, &self->nwaitempty, 1);
+  THQueue_ring(self, 0);
+}
+
+static int THQueue_ringenqueue(THQueueRing *self, THCharStorage *callback, THCharStorage *arg)
+{
+  THQueueSlot *slot;
+  long pos = THAtomicGetLong(&self->enqueuepos);
+
+  if(self->flags & THQUEUE_SPSC) {
+    slot = &self->slots[pos & self->mask];
+    if(THAtomicGetLong(&slot->seq) != pos)
+      return 0; /* full */
+    slot->callback = callback;
+    slot->arg = arg;
+    THAtomicSetLong(&slot->seq, THQueue_add(pos, 1));
+    THAtomicSetLong(&self->enqueuepos, THQueue_add(pos, 1));
+    return 1;
+  }
+
+  for(;;) {
+    long dif;
+    slot = &self->slots[pos & self->mask];
+    dif = THQueue_diff(THAtomicGetLong(&slot->seq), pos);
+    if(dif == 0) {
+      if(THAtomicCompareAndSwapLong(&self->enqueuepos, pos, THQueue_add(pos, 1)))
+        break;
+      pos = THAtomicGetLong(&self->enqueuepos);
+    }
+    else if(dif < 0)
+      return 0; /* full */
+    else
+      pos = THAtomicGetLong(&self->enqueuepos);
+  }
+
+  slot->callback = callback;
+  slot->arg = arg;
+  THAtomicSetLong(&slot->seq, THQueue_add(pos, 1));
+  return 1;
+}
+
+static int THQueue_ringdequeue(THQueueRing *self, THCharStorage **callback, THCharStorage **arg)
+{
+  THQueueSlot *slot;
+  long pos = THAtomicGetLong(&self->dequeuepos);
+
+  if(self->flags & THQUEUE_SPSC) {
+    slot = &self->slots[pos & self->mask];
+    if(THAtomicGetLong(&slot->seq) != THQueue_add(pos, 1))
+      return 0; /* empty */
+    *callback = slot->callback;
+    *arg = slot->arg;
+    slot->callback = NULL;
+    slot->arg = NULL;
+    THAtomicSetLong(&self->dequeuepos, THQueue_add(pos, 1));
+    THAtomicSetLong(&slot->seq, THQueue_add(pos, self->mask+1));
+    return 1;
+  }
+
+  for(;;) {
+    long dif;
+    slot = &self->slots[pos & self->mask];
+    dif = THQueue_diff(THAtomicGetLong(&slot->seq), THQueue_add(pos, 1));
+    if(dif == 0) {
+      if(THAtomicCompareAndSwapLong(&self->dequeuepos, pos, THQueue_add(pos, 1)))
+        break;
+      pos = THAtomicGetLong(&self->dequeuepos);
+    }
+    else if(dif < 0)
+      return 0; /* empty */
+    else
+      pos = THAtomicGetLong(&self->dequeuepos);
+  }
+
+  *callback = slot->callback;
+  *arg = slot->arg;
+  slot->callback = NULL;
+  slot->arg = NULL;
+  THAtomicSetLong(&slot->seq, THQueue_add(pos, self->mask+1));
+  return 1;
+}
+
+/* doubles the capacity of a ring (under growmutex)
+   returns 1 if it could not be allocated */
+static int THQueue_ringgrow(THQueueRing *ring)
+{
+  long capacity = 2*(ring->mask+1);
+  long head = ring->dequeuepos;
+  long tail = ring->enqueuepos;
+  long mask = capacity-1;
+  long pos;
+  THQueueSlot *slots;
+
+  if(capacity > INT_MAX || !(slots = calloc(capacity, sizeof(THQueueSlot))))
+    return 1;
+  for(pos = head; pos != tail; pos = THQueue_add(pos, 1)) {
+    THQueueSlot *slot = &ring->slots[pos & ring->mask];
+    slots[pos & mask].callback = slot->callback;
+    slots[pos & mask].arg = slot->arg;
+    slots[pos & mask].seq = THQueue_add(pos, 1);
+  }
+  for(; pos != THQueue_add(head, capacity); pos = THQueue_add(pos, 1))
+    slots[pos & mask].seq = pos;
+  free(ring->slots);
+  ring->slots = slots;
+  ring->mask = mask;
+  return 0;
+}
+
+/* doubles the capacity of a full jobs ring, and of the buffers ring, so
+   that it still holds the buffers of every job (under growmutex)
+   returns 1 if the jobs ring could not be grown */
+static int THQueue_grow(THQueue *self)
+{
+  if(THQueue_ringgrow(&self->jobs))
+    return 1;
+  THAtomicSet(&self->size, (int)(self->jobs.mask+1));
+  THQueue_ringgrow(&self->buffers); /* otherwise, fewer buffers are recycled */
+  return 0;
+}
+
+static int THQueue_enqueue(THQueue *self, THCharStorage *callback, THCharStorage *arg)
+{
+  long depth, maxdepth;
+  if(self->growmutex) {
+    int done;
+    THMutex_lock(self->growmutex);
+    done = THQueue_ringenqueue(&self->jobs, callback, arg)
+      || (!THQueue_grow(self) && THQueue_ringenqueue(&self->jobs, callback, arg));
+    THMutex_unlock(self->growmutex);
+    if(!done)
+      return 0;
+  }
+  else if(!THQueue_ringenqueue(&self->jobs, callback, arg))
+    return 0;
+  depth = THQueue_count(self);
+  while(depth > (maxdepth = THAtomicGetLong(&self->maxdepth))) {
+    if(THAtomicCompareAndSwapLong(&self->maxdepth, maxdepth, depth))
+      break;
+  }
+  return 1;
+}
+
+static int THQueue_dequeue(THQueue *self, THCharStorage **callback, THCharStorage **arg)
+{
+  int done;
+  if(!self->growmutex)
+    return THQueue_ringdequeue(&self->jobs, callback, arg);
+  THMutex_lock(self->growmutex);
+  done = THQueue_ringdequeue(&self->jobs, callback, arg);
+  THMutex_unlock(self->growmutex);
+  return done;
+}
+
+/* returns 1 if the job was enqueued, 0 if the queue is full, or THQUEUE_CLOSED */
+static int THQueue_tryenqueue(THQueue *self, THCharStorage *callback, THCharStorage *arg)
+{
+  int status = THQUEUE_CLOSED;
+  THAtomicIncrementRef(&self->npushing);
+  if(!THAtomicGet(&self->closing))
+    status = THQueue_enqueue(self, callback, arg);
+  THAtomicAdd(&self->npushing, -1);
+  return status;
+}
+
+/* returns 1 if the job was pushed, 0 if the queue is full, or THQUEUE_CLOSED */
+int THQueue_trypush(THQueue *self, THCharStorage *callback, THCharStorage *arg)
+{
+  int status = THQueue_tryenqueue(self, callback, arg);
+  if(status == 1)
+    THQueue_notify(self);
+  return status;
+}
+
+/* returns 0 when the job was pushed, 1 on error, or THQUEUE_CLOSED */
+int THQueue_push(THQueue *self, THCharStorage *callback, THCharStorage *arg)
+{
+  int status = THQueue_tryenqueue(self, callback, arg);
+  if(!status) {
+    double start = THThread_now();
+    if(THMutex_lock(self->mutex))
+      return 1;
+    THAtomicIncrementRef(&self->nwaitfull);
+    while(!(status = THQueue_tryenqueue(self, callback, arg)))
+      THCondition_wait(self->notfull, self->mutex); /* close broadcasts under the mutex */
+    THAtomicAdd(&self->nwaitfull, -1);
+    self->nblockedfull++;
+    self->blockedfull += THThread_now() - start;
+    THMutex_unlock(self->mutex);
+  }
+  if(status == THQUEUE_CLOSED)
+    return THQUEUE_CLOSED;
+  THQueue_notify(self);
+  return 0;
+}
+
+int THQueue_trypop(THQueue *self, THCharStorage **callback, THCharStorage **arg)
+{
+  if(!THQueue_dequeue(self, callback, arg))
+    return 0;
+  THQueue_wake(self, self->notfull, &self->nwaitfull, 1);
+  return 1;
+}
+
+/* waits at most timeout seconds (for ever if timeout < 0)
+   returns 0 with a job, 1 on error, THQUEUE_TIMEDOUT or THQUEUE_CLOSED */
+static int THQueue_waitdequeue(THQueue *self, double timeout, THCharStorage **callback, THCharStorage **arg)
+{
+  double start, deadline;
+  int status = 0;
+  if(THQueue_dequeue(self, callback, arg))
+    return 0;
+  if(timeout == 0)
+    return (THQueue_isclosed(self) ? THQUEUE_CLOSED : THQUEUE_TIMEDOUT);
+  start = THThread_now();
+  deadline = start + timeout;
+  if(THMutex_lock(self->mutex))
+    return 1;
+  THAtomicIncrementRef(&self->nwaitempty);
+  while(!THQueue_dequeue(self, callback, arg)) {
+    if(self->closed) {
+      status = THQUEUE_CLOSED;
+      break;
+    }
+    if(timeout < 0)
+      THCondition_wait(self->notempty, self->mutex);
+    else {
+      double remaining = deadline - THThread_now();
+      if(remaining <= 0) {
+        status = THQUEUE_TIMEDOUT;
+        break;
+      }
+      THCondition_timedwait(self->notempty, self->mutex, remaining);
+    }
+  }
+  THAtomicAdd(&self->nwaitempty, -1);
+  self->nblockedempty++;
+  self->blockedempty += THThread_now() - start;
+  THMutex_unlock(self->mutex);
+  return status;
+}
+
+int THQueue_pop(THQueue *self, THCharStorage **callback, THCharStorage **arg)
+{
+  return THQueue_timedpop(self, -1, callback, arg);
+}
+
+/* returns 0 with a job, 1 on error, THQUEUE_TIMEDOUT after timeout seconds
+   (timeout < 0 waits for ever), or THQUEUE_CLOSED if the queue is closed and empty */
+int THQueue_timedpop(THQueue *self, double timeout, THCharStorage **callback, THCharStorage **arg)
+{
+  int status = THQueue_waitdequeue(self, timeout, callback, arg);
+  if(status)
+    return status;
+  THQueue_wake(self, self->notfull, &self->nwaitfull, 1);
+  return 0;
+}
+
+/* waits for the first job only, then takes whatever else is ready (up to max)
+   and wakes the parked producers in one go; returns the number of jobs
+   (0 if the queue is closed and empty, -1 on error) */
+int THQueue_popmany(THQueue *self, int max, THCharStorage **callbacks, THCharStorage **args)
+{
+  int n = 0, status;
+  if(max < 1)
+    return 0;
+  status = THQueue_waitdequeue(self, -1, &callbacks[0], &args[0]);
+  if(status == THQUEUE_CLOSED)
+    return 0;
+  if(status)
+    return -1;
+  n = 1;
+  while(n < max && THQueue_dequeue(self, &callbacks[n], &args[n]))
+    n++;
+  THQueue_wake(self, self->notfull, &self->nwaitfull, n);
+  return n;
+}
+
+void THQueue_stats(THQueue *self, THQueueStats *stats)
+{
+  stats->enqueued = THAtomicGetLong(&self->jobs.enqueuepos);
+  stats->dequeued = THAtomicGetLong(&self->jobs.dequeuepos);
+  stats->depth = THQueue_count(self);
+  stats->maxdepth = THAtomicGetLong(&self->maxdepth);
+  stats->nallocated = THAtomicGetLong(&self->nallocated);
+  THMutex_lock(self->mutex);
+  stats->nblockedfull = self->nblockedfull;
+  stats->nblockedempty = self->nblockedempty;
+  stats->blockedfull = self->blockedfull;
+  stats->blockedempty = self->blockedempty;
+  THMutex_unlock(self->mutex);
+}
+
+/* wakes up all producers and consumers; pushes fail from then on, and pops
+   do not wait on the queue anymore once it is empty */
+void THQueue_close(THQueue *self)
+{
+  THMutex_lock(self->mutex);
+  THAtomicSet(&self->closing, 1);
+  THCondition_broadcast(self->notfull);
+  THMutex_unlock(self->mutex);
+  while(THAtomicGet(&self->npushing) > 0)
+    THThread_yield();
+  THMutex_lock(self->mutex);
+  THAtomicSet(&self->closed, 1);
+  THCondition_broadcast(self->notempty);
+  THMutex_unlock(self->mutex);
+  THQueue_ring(self, 1);
+}
+
+int THQueue_isclosed(THQueue *self)
+{
+  return THAtomicGet(&self->closed);
+}
+
+/* a storage of at least size bytes, from the recycled ones if possible */
+THCharStorage* THQueue_getbuffer(THQueue *self, long size)
+{
+  THCharStorage *buffer = NULL;
+  THCharStorage *dummy = NULL;
+  int done;
+  if(self->growmutex)
+    THMutex_lock(self->growmutex);
+  done = THQueue_ringdequeue(&self->buffers, &buffer, &dummy);
+  if(self->growmutex)
+    THMutex_unlock(self->growmutex);
+  if(done) {
+    if(buffer->size < size)
+      THCharStorage_resize(buffer, size);
+    return buffer;
+  }
+  THAtomicAddLong(&self->nallocated, 1);
+  return THCharStorage_newWithSize(size);
+}
+
+/* takes over a reference on a storage which is not used anymore */
+void THQueue_putbuffer(THQueue *self, THCharStorage *buffer)
+{
+  int done = 0;
+  if(buffer->size <= THQUEUE_MAXBUFFER && (buffer->flag & TH_STORAGE_RESIZABLE)) {
+    if(self->growmutex)
+      THMutex_lock(self->growmutex);
+    done = THQueue_ringenqueue(&self->buffers, buffer, NULL);
+    if(self->growmutex)
+      THMutex_unlock(self->growmutex);
+  }
+  if(!done)
+    THCharStorage_free(buffer);
+}
+
+static int THQueue_register(THQueue *self, THQueueWaiter *waiter)
+{
+  THMutex_lock(self->mutex);
+  if(self->nwaiters == self->maxwaiters) {
+    int maxwaiters = (self->maxwaiters ? 2*self->maxwaiters : 4);
+    THQueueWaiter **waiters = realloc(self->waiters, maxwaiters*sizeof(THQueueWaiter*));
+    if(!waiters) {
+      THMutex_unlock(self->mutex);
+      return 1;
+    }
+    self->waiters = waiters;
+    self->maxwaiters = maxwaiters;
+  }
+  self->waiters[self->nwaiters++] = waiter;
+  THAtomicIncrementRef(&self->nselect);
+  THMutex_unlock(self->mutex);
+  return 0;
+}
+
+static void THQueue_unregister(THQueue *self, THQueueWaiter *waiter)
+{
+  int i;
+  THMutex_lock(self->mutex);
+  for(i = 0; i < self->nwaiters; i++) {
+    if(self->waiters[i] == waiter) {
+      self->waiters[i] = self->waiters[--self->nwaiters];
+      THAtomicAdd(&self->nselect, -1);
+      break;
+    }
+  }
+  THMutex_unlock(self->mutex);
+}
+
+static int THQueue_tryselect(THQueue **queues, int n, int start, THCharStorage **callback, THCharStorage **arg)
+{
+  int i;
+  for(i = 0; i < n; i++) {
+    int idx = (start+i) % n;
+    if(THQueue_trypop(queues[idx], callback, arg))
+      return idx;
+  }
+  return -1;
+}
+
+static int THQueue_allclosed(THQueue **queues, int n)
+{
+  int i;
+  for(i = 0; i < n; i++) {
+    if(!THQueue_isclosed(queues[i]))
+      return 0;
+  }
+  return 1;
+}
+
+int THQueue_select(THQueue **queues, int n, int start, THQueueWaiter *waiter, THCharStorage **callback, THCharStorage **arg)
+{
+  return THQueue_timedselect(queues, n, start, waiter, -1, callback, arg);
+}
+
+/* pops from the first non-empty queue, starting the search at queues[start];
+   waits at most timeout seconds (for ever if timeout < 0) if all queues are
+   empty, unless waiter is NULL or all queues are closed
+   returns the index of the queue, -1 if nothing was available, -2 on error */
+int THQueue_timedselect(THQueue **queues, int n, int start, THQueueWaiter *waiter, double timeout,
+                        THCharStorage **callback, THCharStorage **arg)
+{
+  int idx, i;
+  int done = 0;
+  double deadline = THThread_now() + timeout;
+
+  if(n < 1)
+    return -2;
+  start = ((start % n) + n) % n;
+  if((idx = THQueue_tryselect(queues, n, start, callback, arg)) >= 0 || !waiter)
+    return idx;
+
+  for(;;) {
+    waiter->signaled = 0;
+    for(i = 0; i < n; i++) {
+      if(THQueue_register(queues[i], waiter)) {
+        while(i-- > 0)
+          THQueue_unregister(queues[i], waiter);
+        return -2;
+      }
+    }
+
+    idx = THQueue_tryselect(queues, n, start, callback, arg);
+    if(idx < 0 && THQueue_allclosed(queues, n))
+      done = 1;
+    else if(idx < 0) {
+      THMutex_lock(waiter->mutex);
+      while(!waiter->signaled) {
+        if(timeout < 0)
+          THCondition_wait(waiter->cond, waiter->mutex);
+        else {
+          double remaining = deadline - THThread_now();
+          if(remaining <= 0) {
+            done = 1;
+            break;
+          }
+          THCondition_timedwait(waiter->cond, waiter->mutex, remaining);
+        }
+      }
+      THMutex_unlock(waiter->mutex);
+    }
+
+    for(i = 0; i < n; i++)
+      THQueue_unregister(queues[i], waiter);
+
+    if(idx < 0)
+      idx = THQueue_tryselect(queues, n, start, callback, arg);
+    if(idx >= 0) {
+      int signaled;
+      THMutex_lock(waiter->mutex);
+      signaled = waiter->signaled;
+      THMutex_unlock(waiter->mutex);
+      if(signaled) {
+        for(i = 0; i < n; i++) {
+          if(!THQueue_isempty(queues[i]))
+            THQueue_ring(queues[i], 0);
+        }
+      }
+      return idx;
+    }
+    if(done)
+      return -1;
+  }
+}
+
+void THQueue_free(THQueue *self)
+{
+  THQueue_freeWith(self, NULL, NULL);
+}
+
+/* like free; when the last reference goes, release(data, callback, arg),
+   if given, takes over each job still in the queue (e.g. to release the
+   objects its arguments reference) */
+void THQueue_freeWith(THQueue *self, void (*release)(void*, THCharStorage*, THCharStorage*), void *data)
+{
+  if(self) {
+    if(THAtomicDecrementRef(&self->refcount)) {
+      THCharStorage *callback, *arg;
+      while(release && THQueue_ringdequeue(&self->jobs, &callback, &arg))
+        release(data, callback, arg);
+      THMutex_free(self->mutex);
+      THMutex_free(self->growmutex);
+      THCondition_free(self->notfull);
+      THCondition_free(self->notempty);
+      THQueue_ringfree(&self->jobs);
+      THQueue_ringfree(&self->buffers);
+      free(self->waiters);
+      free(self->serialize);
+      free(self->info);
+      free(self);
+    }
+  }
+}
+
+THQueueWaiter* THQueueWaiter_new(void)
+{
+  THQueueWaiter *self = calloc(1, sizeof(THQueueWaiter));
+  if(!self)
+    return NULL;
+  self->mutex = THMutex_new();
+  self->cond = THCondition_new();
+  if(!self->mutex || !self->cond) {
+    THMutex_free(self->mutex);
+    THCondition_free(self->cond);
+    free(self);
+    return NULL;
+  }
+  return self;
+}
+
+void THQueueWaiter_free(THQueueWaiter *self)
+{
+  if(self) {
+    THMutex_free(self->mutex);
+    THCondition_free(self->cond);
+    free(self);
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef TH_QUEUE_INC
+#define TH_QUEUE_INC
+
+#include "TH.h"
+#include "THThread.h"
+
+#define THQUEUE_SPSC 1
+#define THQUEUE_ADAPTIVE 2 /* the queue mutex is adaptive (see THMUTEX_ADAPTIVE) */
+#define THQUEUE_GROWABLE 4 /* the ring doubles its capacity instead of being full */
+
+/* pop status, besides 0 (success) and 1 (error) */
+#define THQUEUE_TIMEDOUT THTHREAD_TIMEDOUT
+#define THQUEUE_CLOSED 3
+
+typedef struct THQueue_ THQueue;
+typedef struct THQueueWaiter_ THQueueWaiter;
+
+/* counters since the creation of the queue (positions wrap around, as unsigned longs)
+   waits are only counted in push and pop/popmany, not in select */
+typedef struct THQueueStats_ {
+  long enqueued;        /* jobs pushed */
+  long dequeued;        /* jobs popped */
+  long depth;           /* jobs in the queue */
+  long maxdepth;        /* highest number of jobs in the queue after a push */
+  long nblockedfull;    /* pushes which found the queue full */
+  long nblockedempty;   /* pops which had to wait for a job */
+  double blockedfull;   /* seconds spent by producers waiting for room */
+  double blockedempty;  /* seconds spent by consumers waiting for a job */
+  long nallocated;      /* buffers allocated by getbuffer, none being recycled */
+} THQueueStats;
+
+THQueue* THQueue_new(int size, const char *serialize);
+THQueue* THQueue_newWithFlags(int size, const char *serialize, int flags);
+THQueue* THQueue_newWithId(AddressType id);
+AddressType THQueue_id(THQueue *self);
+void THQueue_retain(THQueue *self);
+const char* THQueue_serialize(THQueue *self);
+int THQueue_setinfo(THQueue *self, const char *info);
+const char* THQueue_info(THQueue *self);
+int THQueue_size(THQueue *self);
+long THQueue_head(THQueue *self);
+long THQueue_tail(THQueue *self);
+int THQueue_isempty(THQueue *self);
+int THQueue_isfull(THQueue *self);
+THMutex* THQueue_mutex(THQueue *self);
+THCondition* THQueue_notfull(THQueue *self);
+THCondition* THQueue_notempty(THQueue *self);
+int THQueue_trypush(THQueue *self, THCharStorage *callback, THCharStorage *arg);
+int THQueue_push(THQueue *self, THCharStorage *callback, THCharStorage *arg);
+int THQueue_trypop(THQueue *self, THCharStorage **callback, THCharStorage **arg);
+int THQueue_pop(THQueue *self, THCharStorage **callback, THCharStorage **arg);
+int THQueue_timedpop(THQueue *self, double timeout, THCharStorage **callback, THCharStorage **arg);
+int THQueue_popmany(THQueue *self, int max, THCharStorage **callbacks, THCharStorage **args);
+void THQueue_stats(THQueue *self, THQueueStats *stats);
+void THQueue_close(THQueue *self);
+int THQueue_isclosed(THQueue *self);
+THCharStorage* THQueue_getbuffer(THQueue *self, long size);
+void THQueue_putbuffer(THQueue *self, THCharStorage *buffer);
+int THQueue_select(THQueue **queues, int n, int start, THQueueWaiter *waiter, THCharStorage **callback, THCharStorage **arg);
+int THQueue_timedselect(THQueue **queues, int n, int start, THQueueWaiter *waiter, double timeout,
+                        THCharStorage **callback, THCharStorage **arg);
+void THQueue_free(THQueue *self);
+void THQueue_freeWith(THQueue *self, void (*release)(void*, THCharStorage*, THCharStorage*), void *data);
+
+THQueueWaiter* THQueueWaiter_new(void);
+void THQueueWaiter_free(THQueueWaiter *self);
+
+#endif
@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* cpu sets */
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 
@@ -6,6 +10,18 @@
 
 #if defined(USE_PTHREAD_THREADS)
 #include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#define THSEMAPHORE_FUTEX 1
+#define THTHREAD_MPOL_PREFERRED 1 /* see set_mempolicy(2) */
+#endif
 
 #elif defined(USE_WIN32_THREADS)
 
@@ -16,18 +32,36 @@
 
 typedef HANDLE pthread_t;
 typedef DWORD pthread_attr_t;
-typedef HANDLE pthread_mutex_t;
-typedef HANDLE pthread_cond_t;
+typedef CRITICAL_SECTION pthread_mutex_t;
+typedef CONDITION_VARIABLE pthread_cond_t;
 typedef HANDLE pthread_mutexattr_t;
 typedef HANDLE pthread_condattr_t;
 typedef unsigned ( __stdcall *THREAD_FUNCTION )( void * );
 #define restrict __restrict
 
+/* the attributes are only a stack size */
+static int pthread_attr_init(pthread_attr_t *attr)
+{
+  *attr = 0;
+  return 0;
+}
+
+static int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize)
+{
+  *attr = (DWORD)stacksize;
+  return 0;
+}
+
+static int pthread_attr_destroy(pthread_attr_t *attr)
+{
+  return 0;
+}
+
 static int pthread_create(pthread_t *restrict thread,
                           const pthread_attr_t *restrict attr, void *(*start_routine)(void *),
                           void *restrict arg)
 {
-  *thread = (HANDLE)_beginthreadex(NULL, 0, (THREAD_FUNCTION)start_routine, arg, 0, NULL);
+  *thread = (HANDLE)_beginthreadex(NULL, (attr ? *attr : 0), (THREAD_FUNCTION)start_routine, arg, 0, NULL);
   return (int)(*thread == NULL);
 }
 
@@ -36,50 +70,108 @@ static int pthread_join(pthread_t thread, void **value_ptr)
   return ((WaitForSingleObject((thread), INFINITE) != WAIT_OBJECT_0) || !CloseHandle(thread));
 }
 
+/* critical sections, which native condition variables (Vista and later) can wait on */
 static int pthread_mutex_init(pthread_mutex_t *restrict mutex,
                               const pthread_mutexattr_t *restrict attr)
 {
-  *mutex = CreateMutex(NULL, FALSE, NULL);
-  return (int)(*mutex == NULL);
+  InitializeCriticalSection(mutex);
+  return 0;
 }
 
 static int pthread_mutex_lock(pthread_mutex_t *mutex)
 {
-  return WaitForSingleObject(*mutex, INFINITE) != 0;
+  EnterCriticalSection(mutex);
+  return 0;
+}
+
+static int pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+  return !TryEnterCriticalSection(mutex);
 }
 
 static int pthread_mutex_unlock(pthread_mutex_t *mutex)
 {
-  return ReleaseMutex(*mutex) == 0;
+  LeaveCriticalSection(mutex);
+  return 0;
 }
 
 static int pthread_mutex_destroy(pthread_mutex_t *mutex)
 {
-  return CloseHandle(*mutex) == 0;
+  DeleteCriticalSection(mutex);
+  return 0;
 }
 
 static int pthread_cond_init(pthread_cond_t *restrict cond,
                              const pthread_condattr_t *restrict attr)
 {
-  *cond = CreateEvent(NULL, FALSE, FALSE, NULL);
-  return (int)(*cond == NULL);
+  InitializeConditionVariable(cond);
+  return 0;
 }
 
 static int pthread_cond_wait(pthread_cond_t *restrict cond,
                              pthread_mutex_t *restrict mutex)
 {
-  SignalObjectAndWait(*mutex, *cond, INFINITE, FALSE);
-  return WaitForSingleObject(*mutex, INFINITE) != 0;
+  return !SleepConditionVariableCS(cond, mutex, INFINITE);
 }
 
 static int pthread_cond_destroy(pthread_cond_t *cond)
 {
-  return CloseHandle(*cond) == 0;
+  return 0;
 }
 
 int pthread_cond_signal(pthread_cond_t *cond)
 {
-  return SetEvent(*cond) == 0;
+  WakeConditionVariable(cond);
+  return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+  WakeAllConditionVariable(cond);
+  return 0;
+}
+
+/* slim reader-writer locks must be released in the mode they were taken:
+   the writer (there is at most one, with no readers) leaves a mark */
+typedef struct {
+  SRWLOCK lock;
+  int writer;
+} pthread_rwlock_t;
+
+static int pthread_rwlock_init(pthread_rwlock_t *rwlock, void *attr)
+{
+  InitializeSRWLock(&rwlock->lock);
+  rwlock->writer = 0;
+  return 0;
+}
+
+static int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+  AcquireSRWLockShared(&rwlock->lock);
+  return 0;
+}
+
+static int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+  AcquireSRWLockExclusive(&rwlock->lock);
+  rwlock->writer = 1;
+  return 0;
+}
+
+static int pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+  if(rwlock->writer) {
+    rwlock->writer = 0;
+    ReleaseSRWLockExclusive(&rwlock->lock);
+  }
+  else
+    ReleaseSRWLockShared(&rwlock->lock);
+  return 0;
+}
+
+static int pthread_rwlock_destroy(pthread_rwlock_t *rwlock)
+{
+  return 0;
 }
 
 #else
@@ -88,12 +180,30 @@ int pthread_cond_signal(pthread_cond_t *cond)
 
 struct THThread_ {
   pthread_t id;
-  int (*func)(void*);
+  void* (*func)(void*);
   THThreadState state;
+  THThreadAttr attr; /* owns attr.cpus */
 };
 
+/* adaptive mutexes try to lock up to THMUTEX_SPIN times (backing off in
+   between) before parking: most critical sections are shorter than a
+   trip through the kernel */
+#define THMUTEX_SPIN 64
+#define THMUTEX_MAXBACKOFF 32
+
+#if defined(_MSC_VER)
+#define THThread_pause() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#define THThread_pause() __asm__ __volatile__("pause")
+#elif defined(__aarch64__) || (defined(__arm__) && defined(__ARM_ARCH_7A__))
+#define THThread_pause() __asm__ __volatile__("yield")
+#else
+#define THThread_pause() do {} while(0)
+#endif
+
 struct THMutex_{
   pthread_mutex_t id;
+  int spin;
   int refcount;
 };
 
@@ -102,19 +212,178 @@ struct THCondition_ {
   int refcount;
 };
 
+struct THRWLock_ {
+  pthread_rwlock_t id;
+  int refcount;
+};
+
+struct THSemaphore_ {
+  int value;
+#if defined(THSEMAPHORE_FUTEX)
+  int nwaiters; /* threads which might be sleeping on the futex (value) */
+#else
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+  int refcount;
+};
+
+/* the threads of a round wait on the turnstile of its parity: a thread
+   which already went through can only wait on the other one, until all
+   the threads of the round went through */
+struct THBarrier_ {
+  pthread_mutex_t mutex;
+  THSemaphore *turnstiles[2];
+  int count;
+  int arrived;
+  int generation;
+  int refcount;
+};
+
+struct THAtomic_ {
+  int64_t value; /* the bits of a double, if THATOMIC_DOUBLE */
+  int flags;
+  int refcount;
+};
+
+/* monotonic time, in seconds */
+double THThread_now(void)
+{
+#if defined(USE_WIN32_THREADS)
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart/(double)freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+#endif
+}
+
+/* lets another thread run */
+void THThread_yield(void)
+{
+#if defined(USE_WIN32_THREADS)
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+/* waits on cond for at most timeout seconds (for ever if timeout < 0)
+   returns 0 when woken up (possibly spuriously), 1 on error, or THTHREAD_TIMEDOUT */
+static int THThread_condwait(pthread_cond_t *cond, pthread_mutex_t *mutex, double timeout)
+{
+#if defined(USE_WIN32_THREADS)
+  if(SleepConditionVariableCS(cond, mutex, (timeout < 0 ? INFINITE : (DWORD)(timeout*1000))))
+    return 0;
+  return (GetLastError() == ERROR_TIMEOUT ? THTHREAD_TIMEDOUT : 1);
+#else
+  struct timeval tv;
+  struct timespec deadline;
+  long sec;
+  int status;
+  if(timeout < 0)
+    return pthread_cond_wait(cond, mutex) != 0;
+  gettimeofday(&tv, NULL); /* condition deadlines are on the realtime clock */
+  sec = (long)timeout;
+  deadline.tv_sec = tv.tv_sec + sec;
+  deadline.tv_nsec = tv.tv_usec*1000 + (long)((timeout-sec)*1e9);
+  if(deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  status = pthread_cond_timedwait(cond, mutex, &deadline);
+  if(status == ETIMEDOUT)
+    return THTHREAD_TIMEDOUT;
+  return status != 0;
+#endif
+}
+
+/* applies the attributes a thread can only set for itself (best effort) */
+static void THThread_place(THThreadAttr *attr)
+{
+#if defined(USE_PTHREAD_THREADS) && defined(__linux__)
+  int i;
+  if(attr->ncpus > 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(i = 0; i < attr->ncpus; i++) {
+      if(attr->cpus[i] >= 0 && attr->cpus[i] < CPU_SETSIZE)
+        CPU_SET(attr->cpus[i], &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+  }
+  if(attr->numanode >= 0 && attr->numanode < (int)(8*sizeof(unsigned long))) {
+    unsigned long nodes = 1UL << attr->numanode;
+    syscall(SYS_set_mempolicy, THTHREAD_MPOL_PREFERRED, &nodes, 8*sizeof(nodes)+1);
+  }
+#elif defined(USE_WIN32_THREADS)
+  int i;
+  DWORD_PTR mask = 0;
+  for(i = 0; i < attr->ncpus; i++) {
+    if(attr->cpus[i] >= 0 && attr->cpus[i] < (int)(8*sizeof(DWORD_PTR)))
+      mask |= ((DWORD_PTR)1) << attr->cpus[i];
+  }
+  if(mask)
+    SetThreadAffinityMask(GetCurrentThread(), mask);
+#endif
+}
+
+static void* THThread_start(void *arg)
+{
+  THThread *self = arg;
+  THThread_place(&self->attr);
+  return self->func(&self->state);
+}
+
 THThread* THThread_new(void* (*func)(void*), void *data)
 {
-  THThread *self = malloc(sizeof(THThread));
+  return THThread_newWithAttr(func, data, NULL);
+}
+
+THThread* THThread_newWithAttr(void* (*func)(void*), void *data, const THThreadAttr *attr)
+{
+  pthread_attr_t pattr;
+  THThread *self = calloc(1, sizeof(THThread));
   if(!self)
     return NULL;
 
+  self->func = func;
   self->state.data = data;
   self->state.status = 0;
+  self->attr.numanode = -1;
+  if(attr) {
+    self->attr = *attr;
+    self->attr.cpus = NULL;
+    if(attr->ncpus > 0) {
+      self->attr.cpus = malloc(attr->ncpus*sizeof(int));
+      if(!self->attr.cpus) {
+        free(self);
+        return NULL;
+      }
+      memcpy(self->attr.cpus, attr->cpus, attr->ncpus*sizeof(int));
+    }
+  }
 
-  if(pthread_create(&self->id, NULL, func, &self->state)) {
+  if(pthread_attr_init(&pattr)) {
+    free(self->attr.cpus);
     free(self);
     return NULL;
   }
+  if((self->attr.stacksize > 0 && pthread_attr_setstacksize(&pattr, (size_t)self->attr.stacksize))
+     || pthread_create(&self->id, &pattr, THThread_start, self)) {
+    pthread_attr_destroy(&pattr);
+    free(self->attr.cpus);
+    free(self);
+    return NULL;
+  }
+  pthread_attr_destroy(&pattr);
   return self;
 }
 
@@ -130,12 +399,33 @@ int THThread_free(THThread *self)
     if(pthread_join(self->id, NULL))
       return 1;
     status = self->state.status;
+    free(self->attr.cpus);
     free(self);
   }
   return status;
 }
 
+/* spinning is pointless if the owner cannot run meanwhile */
+static int THThread_ncores(void)
+{
+#if defined(USE_WIN32_THREADS)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0 ? (int)n : 1);
+#else
+  return 1;
+#endif
+}
+
 THMutex* THMutex_new(void)
+{
+  return THMutex_newWithFlags(0);
+}
+
+THMutex* THMutex_newWithFlags(int flags)
 {
   THMutex *self = malloc(sizeof(THMutex));
   if(!self)
@@ -144,6 +434,7 @@ THMutex* THMutex_new(void)
     free(self);
     return NULL;
   }
+  self->spin = ((flags & THMUTEX_ADAPTIVE) && THThread_ncores() > 1 ? THMUTEX_SPIN : 0);
   self->refcount = 1;
   return self;
 }
@@ -162,11 +453,25 @@ AddressType THMutex_id(THMutex *self)
 
 int THMutex_lock(THMutex *self)
 {
+  int i, j, backoff = 1;
+  for(i = 0; i < self->spin; i++) {
+    if(pthread_mutex_trylock(&self->id) == 0)
+      return 0;
+    for(j = 0; j < backoff; j++)
+      THThread_pause();
+    if(backoff < THMUTEX_MAXBACKOFF)
+      backoff *= 2;
+  }
   if(pthread_mutex_lock(&self->id) != 0)
     return 1;
   return 0;
 }
 
+int THMutex_isadaptive(THMutex *self)
+{
+  return self->spin > 0;
+}
+
 int THMutex_unlock(THMutex *self)
 {
   if(pthread_mutex_unlock(&self->id) != 0)
@@ -184,6 +489,78 @@ void THMutex_free(THMutex *self)
   }
 }
 
+THRWLock* THRWLock_new(void)
+{
+  THRWLock *self = malloc(sizeof(THRWLock));
+  int status;
+  if(!self)
+    return NULL;
+#if defined(__GLIBC__)
+  {
+    /* glibc prefers readers by default: writers would starve under a steady
+       flow of readers */
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    status = pthread_rwlock_init(&self->id, &attr);
+    pthread_rwlockattr_destroy(&attr);
+  }
+#else
+  status = pthread_rwlock_init(&self->id, NULL);
+#endif
+  if(status != 0) {
+    free(self);
+    return NULL;
+  }
+  self->refcount = 1;
+  return self;
+}
+
+THRWLock* THRWLock_newWithId(AddressType id)
+{
+  THRWLock *self = (THRWLock*)id;
+  THAtomicIncrementRef(&self->refcount);
+  return self;
+}
+
+AddressType THRWLock_id(THRWLock *self)
+{
+  return (AddressType)self;
+}
+
+/* shared: along with other readers, but no writer */
+int THRWLock_rdlock(THRWLock *self)
+{
+  if(pthread_rwlock_rdlock(&self->id) != 0)
+    return 1;
+  return 0;
+}
+
+/* exclusive */
+int THRWLock_wrlock(THRWLock *self)
+{
+  if(pthread_rwlock_wrlock(&self->id) != 0)
+    return 1;
+  return 0;
+}
+
+int THRWLock_unlock(THRWLock *self)
+{
+  if(pthread_rwlock_unlock(&self->id) != 0)
+    return 1;
+  return 0;
+}
+
+void THRWLock_free(THRWLock *self)
+{
+  if(self) {
+    if(THAtomicDecrementRef(&self->refcount)) {
+      pthread_rwlock_destroy(&self->id);
+      free(self);
+    }
+  }
+}
+
 THCondition* THCondition_new(void)
 {
   THCondition *self = malloc(sizeof(THCondition));
@@ -216,6 +593,13 @@ int THCondition_signal(THCondition *self)
   return 0;
 }
 
+int THCondition_broadcast(THCondition *self)
+{
+  if(pthread_cond_broadcast(&self->id))
+    return 1;
+  return 0;
+}
+
 int THCondition_wait(THCondition *self, THMutex *mutex)
 {
   if(pthread_cond_wait(&self->id, &mutex->id))
@@ -223,6 +607,11 @@ int THCondition_wait(THCondition *self, THMutex *mutex)
   return 0;
 }
 
+int THCondition_timedwait(THCondition *self, THMutex *mutex, double timeout)
+{
+  return THThread_condwait(&self->id, &mutex->id, timeout);
+}
+
 void THCondition_free(THCondition *self)
 {
   if(self) {
@@ -232,3 +621,432 @@ void THCondition_free(THCondition *self)
     }
   }
 }
+
+#if defined(THSEMAPHORE_FUTEX)
+static long THSemaphore_futex(int *addr, int op, int val, const struct timespec *timeout)
+{
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+#endif
+
+THSemaphore* THSemaphore_new(int value)
+{
+  THSemaphore *self = malloc(sizeof(THSemaphore));
+  if(!self)
+    return NULL;
+  self->value = value;
+#if defined(THSEMAPHORE_FUTEX)
+  self->nwaiters = 0;
+#else
+  if(pthread_mutex_init(&self->mutex, NULL)) {
+    free(self);
+    return NULL;
+  }
+  if(pthread_cond_init(&self->cond, NULL)) {
+    pthread_mutex_destroy(&self->mutex);
+    free(self);
+    return NULL;
+  }
+#endif
+  self->refcount = 1;
+  return self;
+}
+
+THSemaphore* THSemaphore_newWithId(AddressType id)
+{
+  THSemaphore *self = (THSemaphore*)id;
+  THAtomicIncrementRef(&self->refcount);
+  return self;
+}
+
+AddressType THSemaphore_id(THSemaphore *self)
+{
+  return (AddressType)self;
+}
+
+int THSemaphore_value(THSemaphore *self)
+{
+  return THAtomicGet(&self->value);
+}
+
+int THSemaphore_post(THSemaphore *self, int n)
+{
+  if(n <= 0)
+    return 0;
+#if defined(THSEMAPHORE_FUTEX)
+  /* a waiter bumps nwaiters before checking value in the kernel,
+     so either we see it here, or it sees the new value */
+  THAtomicAdd(&self->value, n);
+  if(THAtomicGet(&self->nwaiters) > 0) {
+    if(THSemaphore_futex(&self->value, FUTEX_WAKE_PRIVATE, n, NULL) < 0)
+      return 1;
+  }
+  return 0;
+#else
+  if(pthread_mutex_lock(&self->mutex))
+    return 1;
+  self->value += n;
+  while(n-- > 0) /* one waiter per unit, at most */
+    pthread_cond_signal(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+  return 0;
+#endif
+}
+
+/* returns 1 if the semaphore has been decremented, 0 otherwise */
+int THSemaphore_trywait(THSemaphore *self)
+{
+#if defined(THSEMAPHORE_FUTEX)
+  int value;
+  while((value = THAtomicGet(&self->value)) > 0) {
+    if(THAtomicCompareAndSwap(&self->value, value, value-1))
+      return 1;
+  }
+  return 0;
+#else
+  int acquired = 0;
+  if(pthread_mutex_lock(&self->mutex))
+    return 0;
+  if(self->value > 0) {
+    self->value--;
+    acquired = 1;
+  }
+  pthread_mutex_unlock(&self->mutex);
+  return acquired;
+#endif
+}
+
+/* waits at most timeout seconds (for ever if timeout < 0)
+   returns 0 if the semaphore has been decremented, 1 on error, or THTHREAD_TIMEDOUT */
+int THSemaphore_timedwait(THSemaphore *self, double timeout)
+{
+  double deadline = (timeout < 0 ? 0 : THThread_now() + timeout);
+#if defined(THSEMAPHORE_FUTEX)
+  while(!THSemaphore_trywait(self)) {
+    struct timespec ts;
+    long status;
+    if(timeout >= 0) {
+      double remaining = deadline - THThread_now();
+      if(remaining <= 0)
+        return THTHREAD_TIMEDOUT;
+      ts.tv_sec = (time_t)remaining;
+      ts.tv_nsec = (long)((remaining - ts.tv_sec)*1e9);
+    }
+    THAtomicIncrementRef(&self->nwaiters);
+    status = THSemaphore_futex(&self->value, FUTEX_WAIT_PRIVATE, 0, (timeout < 0 ? NULL : &ts));
+    THAtomicAdd(&self->nwaiters, -1);
+    if(status < 0 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT)
+      return 1;
+  }
+  return 0;
+#else
+  int status = 0;
+  if(pthread_mutex_lock(&self->mutex))
+    return 1;
+  while(self->value <= 0 && status != 1) {
+    if(timeout >= 0) {
+      double remaining = deadline - THThread_now();
+      if(remaining <= 0) {
+        pthread_mutex_unlock(&self->mutex);
+        return THTHREAD_TIMEDOUT;
+      }
+      status = THThread_condwait(&self->cond, &self->mutex, remaining);
+    }
+    else
+      status = THThread_condwait(&self->cond, &self->mutex, -1);
+  }
+  if(status != 1)
+    self->value--;
+  pthread_mutex_unlock(&self->mutex);
+  return (status == 1);
+#endif
+}
+
+int THSemaphore_wait(THSemaphore *self)
+{
+  return THSemaphore_timedwait(self, -1);
+}
+
+void THSemaphore_free(THSemaphore *self)
+{
+  if(self) {
+    if(THAtomicDecrementRef(&self->refcount)) {
+#if !defined(THSEMAPHORE_FUTEX)
+      pthread_cond_destroy(&self->cond);
+      pthread_mutex_destroy(&self->mutex);
+#endif
+      free(self);
+    }
+  }
+}
+
+THBarrier* THBarrier_new(int count)
+{
+  THBarrier *self;
+  if(count <= 0)
+    return NULL;
+  self = malloc(sizeof(THBarrier));
+  if(!self)
+    return NULL;
+  if(pthread_mutex_init(&self->mutex, NULL) != 0) {
+    free(self);
+    return NULL;
+  }
+  self->turnstiles[0] = THSemaphore_new(0);
+  self->turnstiles[1] = THSemaphore_new(0);
+  if(!self->turnstiles[0] || !self->turnstiles[1]) {
+    THSemaphore_free(self->turnstiles[0]);
+    THSemaphore_free(self->turnstiles[1]);
+    pthread_mutex_destroy(&self->mutex);
+    free(self);
+    return NULL;
+  }
+  self->count = count;
+  self->arrived = 0;
+  self->generation = 0;
+  self->refcount = 1;
+  return self;
+}
+
+THBarrier* THBarrier_newWithId(AddressType id)
+{
+  THBarrier *self = (THBarrier*)id;
+  THAtomicIncrementRef(&self->refcount);
+  return self;
+}
+
+AddressType THBarrier_id(THBarrier *self)
+{
+  return (AddressType)self;
+}
+
+int THBarrier_count(THBarrier *self)
+{
+  return self->count;
+}
+
+/* waits until count threads called it; returns THBARRIER_LAST in the last
+   one to arrive, 0 in the others, 1 on error */
+int THBarrier_wait(THBarrier *self)
+{
+  THSemaphore *turnstile;
+  int i;
+  if(pthread_mutex_lock(&self->mutex) != 0)
+    return 1;
+  turnstile = self->turnstiles[self->generation & 1];
+  if(++self->arrived == self->count) {
+    self->arrived = 0;
+    self->generation++;
+    pthread_mutex_unlock(&self->mutex);
+    /* one unit at a time: each post wakes (at most) one waiter, whatever
+       the semaphore implementation */
+    for(i = 1; i < self->count; i++) {
+      if(THSemaphore_post(turnstile, 1) != 0)
+        return 1;
+    }
+    return THBARRIER_LAST;
+  }
+  pthread_mutex_unlock(&self->mutex);
+  if(THSemaphore_wait(turnstile) != 0)
+    return 1;
+  return 0;
+}
+
+void THBarrier_free(THBarrier *self)
+{
+  if(self) {
+    if(THAtomicDecrementRef(&self->refcount)) {
+      THSemaphore_free(self->turnstiles[0]);
+      THSemaphore_free(self->turnstiles[1]);
+      pthread_mutex_destroy(&self->mutex);
+      free(self);
+    }
+  }
+}
+
+/* 64-bit atomic operations (TH only has them for long, which is 32-bit on
+   windows and on 32-bit systems); each one returns the previous value */
+#if defined(USE_WIN32_THREADS)
+static int64_t THAtomic_cas64(volatile int64_t *a, int64_t oldvalue, int64_t newvalue)
+{
+  return InterlockedCompareExchange64((volatile LONG64*)a, newvalue, oldvalue);
+}
+
+static int64_t THAtomic_add64(volatile int64_t *a, int64_t value)
+{
+  return InterlockedExchangeAdd64((volatile LONG64*)a, value);
+}
+
+static int64_t THAtomic_exchange64(volatile int64_t *a, int64_t value)
+{
+  return InterlockedExchange64((volatile LONG64*)a, value);
+}
+
+static int64_t THAtomic_load64(volatile int64_t *a)
+{
+  return InterlockedCompareExchange64((volatile LONG64*)a, 0, 0);
+}
+#elif defined(__ATOMIC_SEQ_CST)
+static int64_t THAtomic_cas64(volatile int64_t *a, int64_t oldvalue, int64_t newvalue)
+{
+  __atomic_compare_exchange_n(a, &oldvalue, newvalue, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return oldvalue; /* updated with the current value on failure */
+}
+
+static int64_t THAtomic_add64(volatile int64_t *a, int64_t value)
+{
+  return __atomic_fetch_add(a, value, __ATOMIC_SEQ_CST);
+}
+
+static int64_t THAtomic_exchange64(volatile int64_t *a, int64_t value)
+{
+  return __atomic_exchange_n(a, value, __ATOMIC_SEQ_CST);
+}
+
+static int64_t THAtomic_load64(volatile int64_t *a)
+{
+  return __atomic_load_n(a, __ATOMIC_SEQ_CST);
+}
+#else
+static int64_t THAtomic_cas64(volatile int64_t *a, int64_t oldvalue, int64_t newvalue)
+{
+  return __sync_val_compare_and_swap(a, oldvalue, newvalue);
+}
+
+static int64_t THAtomic_add64(volatile int64_t *a, int64_t value)
+{
+  return __sync_fetch_and_add(a, value);
+}
+
+static int64_t THAtomic_exchange64(volatile int64_t *a, int64_t value)
+{
+  int64_t current = *a;
+  int64_t previous;
+  while((previous = __sync_val_compare_and_swap(a, current, value)) != current)
+    current = previous;
+  return previous;
+}
+
+static int64_t THAtomic_load64(volatile int64_t *a)
+{
+  return __sync_val_compare_and_swap(a, 0, 0);
+}
+#endif
+
+static int64_t THAtomic_bits(double value)
+{
+  int64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static double THAtomic_double(int64_t bits)
+{
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static THAtomic* THAtomic_newWithFlags(int64_t value, int flags)
+{
+  THAtomic *self = malloc(sizeof(THAtomic));
+  if(!self)
+    return NULL;
+  self->value = value;
+  self->flags = flags;
+  self->refcount = 1;
+  return self;
+}
+
+THAtomic* THAtomic_new(int64_t value)
+{
+  return THAtomic_newWithFlags(value, 0);
+}
+
+THAtomic* THAtomic_newDouble(double value)
+{
+  return THAtomic_newWithFlags(THAtomic_bits(value), THATOMIC_DOUBLE);
+}
+
+THAtomic* THAtomic_newWithId(AddressType id)
+{
+  THAtomic *self = (THAtomic*)id;
+  THAtomicIncrementRef(&self->refcount);
+  return self;
+}
+
+AddressType THAtomic_id(THAtomic *self)
+{
+  return (AddressType)self;
+}
+
+int THAtomic_isdouble(THAtomic *self)
+{
+  return (self->flags & THATOMIC_DOUBLE) != 0;
+}
+
+int64_t THAtomic_get(THAtomic *self)
+{
+  return THAtomic_load64(&self->value);
+}
+
+void THAtomic_set(THAtomic *self, int64_t value)
+{
+  THAtomic_exchange64(&self->value, value);
+}
+
+/* returns the value before the addition */
+int64_t THAtomic_add(THAtomic *self, int64_t value)
+{
+  return THAtomic_add64(&self->value, value);
+}
+
+int64_t THAtomic_exchange(THAtomic *self, int64_t value)
+{
+  return THAtomic_exchange64(&self->value, value);
+}
+
+/* sets the value to newvalue if it is oldvalue; returns the value before
+   (oldvalue if swapped) */
+int64_t THAtomic_compareAndSwap(THAtomic *self, int64_t oldvalue, int64_t newvalue)
+{
+  return THAtomic_cas64(&self->value, oldvalue, newvalue);
+}
+
+/* doubles are compared bitwise, and added with a compare-and-swap loop */
+double THAtomic_getDouble(THAtomic *self)
+{
+  return THAtomic_double(THAtomic_load64(&self->value));
+}
+
+void THAtomic_setDouble(THAtomic *self, double value)
+{
+  THAtomic_exchange64(&self->value, THAtomic_bits(value));
+}
+
+double THAtomic_addDouble(THAtomic *self, double value)
+{
+  int64_t current = THAtomic_load64(&self->value);
+  int64_t previous;
+  while((previous = THAtomic_cas64(&self->value, current, THAtomic_bits(THAtomic_double(current) + value))) != current)
+    current = previous;
+  return THAtomic_double(previous);
+}
+
+double THAtomic_exchangeDouble(THAtomic *self, double value)
+{
+  return THAtomic_double(THAtomic_exchange64(&self->value, THAtomic_bits(value)));
+}
+
+double THAtomic_compareAndSwapDouble(THAtomic *self, double oldvalue, double newvalue)
+{
+  return THAtomic_double(THAtomic_cas64(&self->value, THAtomic_bits(oldvalue), THAtomic_bits(newvalue)));
+}
+
+void THAtomic_free(THAtomic *self)
+{
+  if(self) {
+    if(THAtomicDecrementRef(&self->refcount))
+      free(self);
+  }
+}
@@ -1,6 +1,8 @@
 #ifndef TH_THREAD_INC
 #define TH_THREAD_INC
 
+#include <stdint.h>
+
 #ifndef _MSC_VER
 typedef long AddressType;
 #else
@@ -14,27 +16,101 @@ typedef __int32 AddressType;
 typedef struct THThread_ THThread;
 typedef struct THMutex_ THMutex;
 typedef struct THCondition_ THCondition;
+typedef struct THRWLock_ THRWLock;
+typedef struct THSemaphore_ THSemaphore;
+typedef struct THBarrier_ THBarrier;
+typedef struct THAtomic_ THAtomic;
 typedef struct THThreadState_ {
   void* data;
   int status;
 } THThreadState;
 
+/* where and how a thread runs */
+typedef struct THThreadAttr_ {
+  long stacksize; /* in bytes, 0 for the default */
+  int ncpus;      /* number of cpus the thread is pinned to, 0 for any */
+  int *cpus;
+  int numanode;   /* numa node its memory is preferably allocated on, -1 for any */
+} THThreadAttr;
+
+/* the mutex spins a little before parking the thread */
+#define THMUTEX_ADAPTIVE 1
+
+/* returned by THBarrier_wait in the last thread to arrive */
+#define THBARRIER_LAST 2
+
+/* the atomic holds a double (an integer otherwise) */
+#define THATOMIC_DOUBLE 1
+
+/* returned by timed waits when the timeout has elapsed */
+#define THTHREAD_TIMEDOUT 2
+
+double THThread_now(void);
+void THThread_yield(void);
+
 THThread* THThread_new(void* (*closure)(void*), void *data);
+THThread* THThread_newWithAttr(void* (*closure)(void*), void *data, const THThreadAttr *attr);
 AddressType THThread_id(THThread *self);
 int THThread_free(THThread *self);
 
 THMutex* THMutex_new(void);
+THMutex* THMutex_newWithFlags(int flags);
 THMutex* THMutex_newWithId(AddressType id);
 AddressType THMutex_id(THMutex *self);
 int THMutex_lock(THMutex *self);
 int THMutex_unlock(THMutex *self);
+int THMutex_isadaptive(THMutex *self);
 void THMutex_free(THMutex *self);
 
+THRWLock* THRWLock_new(void);
+THRWLock* THRWLock_newWithId(AddressType id);
+AddressType THRWLock_id(THRWLock *self);
+int THRWLock_rdlock(THRWLock *self);
+int THRWLock_wrlock(THRWLock *self);
+int THRWLock_unlock(THRWLock *self);
+void THRWLock_free(THRWLock *self);
+
 THCondition* THCondition_new(void);
 THCondition* THCondition_newWithId(AddressType id);
 AddressType THCondition_id(THCondition *self);
 int THCondition_signal(THCondition *self);
+int THCondition_broadcast(THCondition *self);
 int THCondition_wait(THCondition *self, THMutex *mutex);
+int THCondition_timedwait(THCondition *self, THMutex *mutex, double timeout);
 void THCondition_free(THCondition *self);
 
+THSemaphore* THSemaphore_new(int value);
+THSemaphore* THSemaphore_newWithId(AddressType id);
+AddressType THSemaphore_id(THSemaphore *self);
+int THSemaphore_value(THSemaphore *self);
+int THSemaphore_post(THSemaphore *self, int n);
+int THSemaphore_trywait(THSemaphore *self);
+int THSemaphore_wait(THSemaphore *self);
+int THSemaphore_timedwait(THSemaphore *self, double timeout);
+void THSemaphore_free(THSemaphore *self);
+
+THBarrier* THBarrier_new(int count);
+THBarrier* THBarrier_newWithId(AddressType id);
+AddressType THBarrier_id(THBarrier *self);
+int THBarrier_count(THBarrier *self);
+int THBarrier_wait(THBarrier *self);
+void THBarrier_free(THBarrier *self);
+
+THAtomic* THAtomic_new(int64_t value);
+THAtomic* THAtomic_newDouble(double value);
+THAtomic* THAtomic_newWithId(AddressType id);
+AddressType THAtomic_id(THAtomic *self);
+int THAtomic_isdouble(THAtomic *self);
+int64_t THAtomic_get(THAtomic *self);
+void THAtomic_set(THAtomic *self, int64_t value);
+int64_t THAtomic_add(THAtomic *self, int64_t value);
+int64_t THAtomic_exchange(THAtomic *self, int64_t value);
+int64_t THAtomic_compareAndSwap(THAtomic *self, int64_t oldvalue, int64_t newvalue);
+double THAtomic_getDouble(THAtomic *self);
+void THAtomic_setDouble(THAtomic *self, double value);
+double THAtomic_addDouble(THAtomic *self, double value);
+double THAtomic_exchangeDouble(THAtomic *self, double value);
+double THAtomic_compareAndSwapDouble(THAtomic *self, double oldvalue, double newvalue);
+void THAtomic_free(THAtomic *self);
+
 #endif
@@ -3,6 +3,7 @@
 
 #if (LUA_VERSION_NUM >= 502)
 #define lua_equal(L, idx1, idx2)  lua_compare(L, (idx1), (idx2), LUA_OPEQ)
+#define lua_objlen(L, idx) lua_rawlen(L, (idx))
 #endif
 
 static int luaTHRD_pushudata(lua_State *L, void *ptr, const char* typename)
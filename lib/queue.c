@@ -2,178 +2,146 @@
 #include "luaT.h" /* for handling THCHarStorage */
 #include "luaTHRD.h"
 #include "THThread.h"
+#include "THQueue.h"
 #include <lua.h>
 #include <lualib.h>
 #include <lualib.h>
+#include <string.h>
 
 
-typedef struct THQueue_ {
-  THMutex *mutex;
-  THCondition *notfull;
-  THCondition *notempty;
-  THCharStorage **callbacks;
-  THCharStorage **args;
-  char* serialize;
-
-  int head;
-  int tail;
-  int isempty;
-  int isfull;
-  int size;
-  int refcount;
-} THQueue;
-
 static int queue_new(lua_State *L)
 {
   THQueue *queue = NULL;
 
   if(lua_gettop(L) == 1) {
-
-    queue = (THQueue*)luaL_checkinteger(L, 1);
-    THMutex_lock(queue->mutex);
-    queue->refcount = queue->refcount + 1;
-    THMutex_unlock(queue->mutex);
-
-  } else if(lua_gettop(L) == 2) {
-
+    AddressType id = luaL_checkaddr(L, 1);
+    queue = THQueue_newWithId(id);
+  }
+  else if(lua_gettop(L) == 2 || lua_gettop(L) == 3) {
     int size = luaL_checkint(L, 1);
     const char *serialize = luaL_checkstring(L, 2);
-    size_t serialize_len;
-    lua_tolstring(L, 2, &serialize_len);
-
-    queue = calloc(1, sizeof(THQueue)); /* zeroed */
+    const char *info = NULL;
+    int flags = 0;
+    luaL_argcheck(L, size > 0, 1, "positive size expected");
+    if(!lua_isnoneornil(L, 3)) {
+      luaL_checktype(L, 3, LUA_TTABLE);
+      lua_getfield(L, 3, "spsc");
+      if(lua_toboolean(L, -1))
+        flags |= THQUEUE_SPSC;
+      lua_pop(L, 1);
+      lua_getfield(L, 3, "adaptive");
+      if(lua_toboolean(L, -1))
+        flags |= THQUEUE_ADAPTIVE;
+      lua_pop(L, 1);
+      lua_getfield(L, 3, "growable");
+      if(lua_toboolean(L, -1))
+        flags |= THQUEUE_GROWABLE;
+      lua_pop(L, 1);
+      lua_getfield(L, 3, "info");
+      if(!lua_isnil(L, -1))
+        info = luaL_checkstring(L, -1); /* stays on the stack */
+    }
+    queue = THQueue_newWithFlags(size, serialize, flags);
     if(!queue)
-      goto outofmem;
-
-    queue->mutex = THMutex_new();
-    queue->notfull = THCondition_new();
-    queue->notempty = THCondition_new();
-    queue->callbacks = calloc(size, sizeof(THCharStorage*));
-    queue->args = calloc(size, sizeof(THCharStorage*));
-    queue->serialize = malloc(serialize_len+1);
-    if(queue->serialize)
-      memcpy(queue->serialize, serialize, serialize_len+1);
-
-    queue->head = 0;
-    queue->tail = 0;
-    queue->isempty = 1;
-    queue->isfull = 0;
-    queue->size = size;
-    queue->refcount = 1;
-
-    if(!queue->mutex || !queue->notfull || !queue->notempty
-       || !queue->callbacks || !queue->args || !queue->serialize)
-      goto outofmemfree;
-
-  } else
+      luaL_error(L, "threads: queue new out of memory");
+    if(info && THQueue_setinfo(queue, info)) {
+      THQueue_free(queue);
+      luaL_error(L, "threads: queue new out of memory");
+    }
+  }
+  else
     luaL_error(L, "threads: queue new invalid arguments");
 
-  if(!luaTHRD_pushudata(L, queue, "threads.Queue"))
-    goto outofmemfree;
+  if(!luaTHRD_pushudata(L, queue, "threads.Queue")) {
+    THQueue_free(queue);
+    luaL_error(L, "threads: queue new out of memory");
+  }
 
   return 1;
-
-
-  outofmemfree:
-  THMutex_free(queue->mutex);
-  THCondition_free(queue->notfull);
-  THCondition_free(queue->notempty);
-  free(queue->callbacks);
-  free(queue->args);
-  free(queue->serialize);
-  free(queue);
-  outofmem:
-  luaL_error(L, "threads: queue new out of memory");
-  return 0;
-}
-
-static int queue_free(lua_State *L)
-{
-  THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  if(THAtomicDecrementRef(&queue->refcount))
-  {
-    int i;
-    THMutex_free(queue->mutex);
-    THCondition_free(queue->notfull);
-    THCondition_free(queue->notempty);
-    for(i = 0; i < queue->size; i++) {
-      if(queue->callbacks[i])
-        THCharStorage_free(queue->callbacks[i]);
-      if(queue->args[i])
-        THCharStorage_free(queue->args[i]);
-    }
-    free(queue->serialize);
-    free(queue->callbacks);
-    free(queue->args);
-    free(queue);
-  }
-  return 0;
 }
 
 static int queue_retain(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  THAtomicIncrementRef(&queue->refcount);
+  THQueue_retain(queue);
   return 0;
 }
 
 static int queue_get_mutex(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  return luaTHRD_pushudata(L, queue->mutex, "threads.Mutex");
+  return luaTHRD_pushudata(L, THQueue_mutex(queue), "threads.Mutex");
 }
 
 static int queue_get_notfull(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  return luaTHRD_pushudata(L, queue->notfull, "threads.Condition");
+  return luaTHRD_pushudata(L, THQueue_notfull(queue), "threads.Condition");
 }
 
 static int queue_get_notempty(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  return luaTHRD_pushudata(L, queue->notempty, "threads.Condition");
+  return luaTHRD_pushudata(L, THQueue_notempty(queue), "threads.Condition");
 }
 
 static int queue_get_serialize(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  lua_pushstring(L, queue->serialize);
+  lua_pushstring(L, THQueue_serialize(queue));
+  return 1;
+}
+
+static int queue_get_info(lua_State *L)
+{
+  THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
+  const char *info = THQueue_info(queue);
+  if(info)
+    lua_pushstring(L, info);
+  else
+    lua_pushnil(L);
   return 1;
 }
 
 static int queue_get_head(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  lua_pushnumber(L, queue->head);
+  lua_pushnumber(L, THQueue_head(queue));
   return 1;
 }
 
 static int queue_get_tail(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  lua_pushnumber(L, queue->tail);
+  lua_pushnumber(L, THQueue_tail(queue));
   return 1;
 }
 
 static int queue_get_isempty(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  lua_pushnumber(L, queue->isempty);
+  lua_pushnumber(L, THQueue_isempty(queue));
   return 1;
 }
 
 static int queue_get_isfull(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  lua_pushnumber(L, queue->isfull);
+  lua_pushnumber(L, THQueue_isfull(queue));
+  return 1;
+}
+
+static int queue_get_isclosed(lua_State *L)
+{
+  THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
+  lua_pushnumber(L, THQueue_isclosed(queue));
   return 1;
 }
 
 static int queue_get_size(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  lua_pushnumber(L, queue->size);
+  lua_pushnumber(L, THQueue_size(queue));
   return 1;
 }
 
@@ -200,127 +168,619 @@ static int queue__index(lua_State *L)
   return 1;
 }
 
-static int queue_callback(lua_State *L)
+/* compact encoding of flat argument tables:
+   0xFF (never the first byte of a torch binary object), the encoded size,
+   the number of array and hash entries, then (key, value) pairs; keys are numbers or
+   strings, values are booleans, numbers, strings or (if shared) tensors
+   and storages, passed by pointer with a retain, like sharedserialize */
+
+#define QUEUE_ARGS_MAGIC 0xFF
+
+enum {
+  QUEUE_ARG_FALSE = 1,
+  QUEUE_ARG_TRUE,
+  QUEUE_ARG_NUMBER,
+  QUEUE_ARG_INTEGER,
+  QUEUE_ARG_STRING,
+  QUEUE_ARG_OBJECT
+};
+
+static const char *queue_args_objects[] = {
+  "torch.ByteTensor", "torch.CharTensor", "torch.ShortTensor", "torch.IntTensor",
+  "torch.LongTensor", "torch.FloatTensor", "torch.DoubleTensor", "torch.HalfTensor",
+  "torch.CudaTensor", "torch.CudaByteTensor", "torch.CudaCharTensor", "torch.CudaShortTensor",
+  "torch.CudaIntTensor", "torch.CudaLongTensor", "torch.CudaDoubleTensor", "torch.CudaHalfTensor",
+  "torch.ByteStorage", "torch.CharStorage", "torch.ShortStorage", "torch.IntStorage",
+  "torch.LongStorage", "torch.FloatStorage", "torch.DoubleStorage", "torch.HalfStorage",
+  "torch.CudaStorage", "torch.CudaByteStorage", "torch.CudaCharStorage", "torch.CudaShortStorage",
+  "torch.CudaIntStorage", "torch.CudaLongStorage", "torch.CudaDoubleStorage", "torch.CudaHalfStorage",
+  NULL
+};
+
+static int queue_args_object(lua_State *L, int idx)
 {
-  THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  int idx = luaL_checkint(L, 2);
-  luaL_argcheck(L, idx >= 0 && idx < queue->size, 2, "out of range");
-  if(lua_gettop(L) == 2) {
-    THCharStorage *storage = NULL;
-    if((storage = queue->callbacks[idx])) {
-      THCharStorage_retain(storage);
-      luaT_pushudata(L, storage, "torch.CharStorage");
-      return 1;
+  const char *typename = luaT_typename(L, idx);
+  int i;
+  if(typename) {
+    for(i = 0; queue_args_objects[i]; i++) {
+      if(!strcmp(typename, queue_args_objects[i]))
+        return i;
     }
-    else
+  }
+  return -1;
+}
+
+/* size of the encoded key or value at idx, 0 if it cannot be encoded */
+static size_t queue_args_size(lua_State *L, int idx, int iskey, int share)
+{
+  switch(lua_type(L, idx)) {
+    case LUA_TBOOLEAN:
+      return (iskey ? 0 : 1);
+    case LUA_TNUMBER:
+#if LUA_VERSION_NUM >= 503
+      if(lua_isinteger(L, idx))
+        return 1+sizeof(lua_Integer);
+#endif
+      return 1+sizeof(lua_Number);
+    case LUA_TSTRING:
+      return 1+sizeof(size_t)+lua_objlen(L, idx);
+    case LUA_TUSERDATA:
+      if(!iskey && share && queue_args_object(L, idx) >= 0)
+        return 2+sizeof(void*);
+      return 0;
+    default:
       return 0;
   }
-  else if(lua_gettop(L) == 3) {
-    THCharStorage *storage = luaT_checkudata(L, 3, "torch.CharStorage"); /* DEBUG: might be luaT for torch objects */
-    if(queue->callbacks[idx]) {
-      THCharStorage_free(queue->callbacks[idx]);
+}
+
+static char* queue_args_write(lua_State *L, int idx, char *p)
+{
+  if(idx < 0)
+    idx = lua_gettop(L)+idx+1;
+  switch(lua_type(L, idx)) {
+    case LUA_TBOOLEAN:
+      *p++ = (lua_toboolean(L, idx) ? QUEUE_ARG_TRUE : QUEUE_ARG_FALSE);
+      break;
+    case LUA_TNUMBER:
+#if LUA_VERSION_NUM >= 503
+      if(lua_isinteger(L, idx)) {
+        lua_Integer x = lua_tointeger(L, idx);
+        *p++ = QUEUE_ARG_INTEGER;
+        memcpy(p, &x, sizeof(x));
+        p += sizeof(x);
+        break;
+      }
+#endif
+      {
+        lua_Number x = lua_tonumber(L, idx);
+        *p++ = QUEUE_ARG_NUMBER;
+        memcpy(p, &x, sizeof(x));
+        p += sizeof(x);
+      }
+      break;
+    case LUA_TSTRING:
+      {
+        size_t len;
+        const char *str = lua_tolstring(L, idx, &len);
+        *p++ = QUEUE_ARG_STRING;
+        memcpy(p, &len, sizeof(len));
+        p += sizeof(len);
+        memcpy(p, str, len);
+        p += len;
+      }
+      break;
+    case LUA_TUSERDATA:
+      {
+        int type = queue_args_object(L, idx);
+        void *ptr = luaT_toudata(L, idx, queue_args_objects[type]);
+        lua_getfield(L, idx, "retain"); /* the reader takes over this reference */
+        lua_pushvalue(L, idx);
+        lua_call(L, 1, 0);
+        *p++ = QUEUE_ARG_OBJECT;
+        *p++ = (char)type;
+        memcpy(p, &ptr, sizeof(ptr));
+        p += sizeof(ptr);
+      }
+      break;
+  }
+  return p;
+}
+
+static const char* queue_args_read(lua_State *L, const char *p)
+{
+  switch(*p++) {
+    case QUEUE_ARG_FALSE:
+      lua_pushboolean(L, 0);
+      break;
+    case QUEUE_ARG_TRUE:
+      lua_pushboolean(L, 1);
+      break;
+#if LUA_VERSION_NUM >= 503
+    case QUEUE_ARG_INTEGER:
+      {
+        lua_Integer x;
+        memcpy(&x, p, sizeof(x));
+        p += sizeof(x);
+        lua_pushinteger(L, x);
+      }
+      break;
+#endif
+    case QUEUE_ARG_NUMBER:
+      {
+        lua_Number x;
+        memcpy(&x, p, sizeof(x));
+        p += sizeof(x);
+        lua_pushnumber(L, x);
+      }
+      break;
+    case QUEUE_ARG_STRING:
+      {
+        size_t len;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        lua_pushlstring(L, p, len);
+        p += len;
+      }
+      break;
+    case QUEUE_ARG_OBJECT:
+      {
+        int type = (unsigned char)*p++;
+        void *ptr;
+        memcpy(&ptr, p, sizeof(ptr));
+        p += sizeof(ptr);
+        luaT_pushudata(L, ptr, queue_args_objects[type]);
+      }
+      break;
+    default:
+      luaL_error(L, "threads: corrupted arguments");
+  }
+  return p;
+}
+
+/* encodes the flat table of arguments at idx (into a recycled buffer of queue, if any)
+   returns NULL if the table is not flat */
+static THCharStorage* queue_args_encode(lua_State *L, int idx, int share, THQueue *queue)
+{
+  size_t size = 1+sizeof(size_t)+2*sizeof(int);
+  int narr = 0, nrec = 0;
+  THCharStorage *storage;
+  char *p;
+
+  if(idx < 0)
+    idx = lua_gettop(L)+idx+1;
+
+  lua_pushnil(L);
+  while(lua_next(L, idx)) {
+    size_t keysize = queue_args_size(L, -2, 1, share);
+    size_t valuesize = queue_args_size(L, -1, 0, share);
+    if(!keysize || !valuesize) {
+      lua_pop(L, 2);
+      return NULL;
     }
-    queue->callbacks[idx] = storage;
-    THCharStorage_retain(storage);
+    if(lua_type(L, -2) == LUA_TNUMBER)
+      narr++;
+    else
+      nrec++;
+    size += keysize+valuesize;
+    lua_pop(L, 1);
+  }
+
+  storage = (queue ? THQueue_getbuffer(queue, size) : THCharStorage_newWithSize(size));
+  p = storage->data;
+  *p++ = (char)QUEUE_ARGS_MAGIC;
+  memcpy(p, &size, sizeof(size_t)); /* a recycled buffer might be larger */
+  p += sizeof(size_t);
+  memcpy(p, &narr, sizeof(int));
+  p += sizeof(int);
+  memcpy(p, &nrec, sizeof(int));
+  p += sizeof(int);
+  lua_pushnil(L);
+  while(lua_next(L, idx)) {
+    p = queue_args_write(L, -2, p);
+    p = queue_args_write(L, -1, p);
+    lua_pop(L, 1);
+  }
+
+  return storage;
+}
+
+/* pushes the table of arguments encoded in storage; returns 0 (and
+   pushes nothing) if storage was not encoded by queue_args_encode() */
+static int queue_args_decode(lua_State *L, THCharStorage *storage)
+{
+  const char *p = storage->data;
+  const char *end;
+  size_t size;
+  int narr, nrec;
+
+  if((size_t)storage->size < 1+sizeof(size_t)+2*sizeof(int) || (unsigned char)*p != QUEUE_ARGS_MAGIC)
     return 0;
+  p++;
+  memcpy(&size, p, sizeof(size_t));
+  p += sizeof(size_t);
+  memcpy(&narr, p, sizeof(int));
+  p += sizeof(int);
+  memcpy(&nrec, p, sizeof(int));
+  p += sizeof(int);
+  end = storage->data+size;
+
+  lua_createtable(L, narr, nrec);
+  while(p < end) {
+    p = queue_args_read(L, p);
+    p = queue_args_read(L, p);
+    lua_rawset(L, -3);
   }
-  else
-    luaL_error(L, "invalid arguments");
+  return 1;
+}
+
+/* frees natively encoded arguments which will not be read: the shared
+   objects they reference are released with their decoded table; the buffer
+   is not recycled, as producers only take buffers from the pool (which has
+   a single producer, the consumer, on spsc queues) */
+static void queue_args_discard(lua_State *L, THCharStorage *arg)
+{
+  if(queue_args_decode(L, arg))
+    lua_pop(L, 1);
+  THCharStorage_free(arg);
+}
+
+/* releases a job left in a queue freed by its last user */
+static void queue_release(void *data, THCharStorage *callback, THCharStorage *arg)
+{
+  THCharStorage_free(callback);
+  queue_args_discard((lua_State*)data, arg);
+}
+
+static int queue_free(lua_State *L)
+{
+  THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
+  THQueue_freeWith(queue, queue_release, L);
   return 0;
 }
 
-static int queue_arg(lua_State *L)
+/* pushes the arguments of a popped job: decoded if they have the compact
+   encoding (the buffer is then recycled), as a storage otherwise */
+static void queue_pusharg(lua_State *L, THQueue *queue, THCharStorage *arg)
+{
+  if(queue_args_decode(L, arg))
+    THQueue_putbuffer(queue, arg);
+  else
+    luaT_pushudata(L, arg, "torch.CharStorage"); /* reference handed over to lua */
+}
+
+/* encodes a flat table of arguments; returns nil if it is not flat */
+static int queue_packargs(lua_State *L)
+{
+  THCharStorage *storage;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  storage = queue_args_encode(L, 1, lua_toboolean(L, 2), NULL);
+  if(storage)
+    luaT_pushudata(L, storage, "torch.CharStorage");
+  else
+    lua_pushnil(L);
+  return 1;
+}
+
+/* decodes arguments encoded by packargs; returns nil for anything else */
+static int queue_unpackargs(lua_State *L)
+{
+  THCharStorage *storage = luaT_checkudata(L, 1, "torch.CharStorage");
+  if(!queue_args_decode(L, storage))
+    lua_pushnil(L);
+  return 1;
+}
+
+/* returns true once pushed, nil if the queue is closed (the storages are
+   then left to the caller) */
+static int queue_push(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  int idx = luaL_checkint(L, 2);
-  luaL_argcheck(L, idx >= 0 && idx < queue->size, 2, "out of range");
-  if(lua_gettop(L) == 2) {
-    THCharStorage *storage = NULL;
-    if((storage = queue->args[idx])) {
-      THCharStorage_retain(storage);
-      luaT_pushudata(L, storage, "torch.CharStorage");
-      return 1;
-    }
-    else
-      return 0;
+  THCharStorage *callback = luaT_checkudata(L, 2, "torch.CharStorage");
+  THCharStorage *arg = luaT_checkudata(L, 3, "torch.CharStorage");
+  int status;
+  THCharStorage_retain(callback); /* the queue now holds a reference */
+  THCharStorage_retain(arg);
+  status = THQueue_push(queue, callback, arg);
+  if(status) {
+    THCharStorage_free(callback);
+    THCharStorage_free(arg);
+    if(status != THQUEUE_CLOSED)
+      luaL_error(L, "threads: queue push failed");
+    lua_pushnil(L);
+    return 1;
   }
-  else if(lua_gettop(L) == 3) {
-    THCharStorage *storage = luaT_checkudata(L, 3, "torch.CharStorage"); /* DEBUG: might be luaT for torch objects */
-    if(queue->args[idx])
-      THCharStorage_free(queue->args[idx]);
-    queue->args[idx] = storage;
-    THCharStorage_retain(storage);
-    return 0;
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* like push, without waiting: returns false if the queue is full */
+static int queue_trypush(lua_State *L)
+{
+  THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
+  THCharStorage *callback = luaT_checkudata(L, 2, "torch.CharStorage");
+  THCharStorage *arg = luaT_checkudata(L, 3, "torch.CharStorage");
+  int status;
+  THCharStorage_retain(callback);
+  THCharStorage_retain(arg);
+  status = THQueue_trypush(queue, callback, arg);
+  if(status == 1) {
+    lua_pushboolean(L, 1);
+    return 1;
   }
+  THCharStorage_free(callback);
+  THCharStorage_free(arg);
+  if(status == THQUEUE_CLOSED)
+    lua_pushnil(L);
   else
-    luaL_error(L, "invalid arguments");
-  return 0;
+    lua_pushboolean(L, 0);
+  return 1;
 }
 
+/* returns nothing if the timeout (in seconds) elapsed, or if the queue is closed and empty */
+static int queue_pop(lua_State *L)
+{
+  THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
+  double timeout = luaL_optnumber(L, 2, -1);
+  THCharStorage *callback = NULL;
+  THCharStorage *arg = NULL;
+  int status = THQueue_timedpop(queue, timeout, &callback, &arg);
+  if(status == 1)
+    luaL_error(L, "threads: queue pop failed");
+  if(status)
+    return 0;
+  luaT_pushudata(L, callback, "torch.CharStorage"); /* reference handed over to lua */
+  queue_pusharg(L, queue, arg);
+  return 2;
+}
 
-/* */
+/* pushes a job whose arguments are encoded natively: returns false if they
+   are not flat, true and then true once pushed, nil if the queue is closed */
+static int queue_pushargs(lua_State *L)
+{
+  THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
+  THCharStorage *callback = luaT_checkudata(L, 2, "torch.CharStorage");
+  THCharStorage *arg;
+  int status;
+  luaL_checktype(L, 3, LUA_TTABLE);
+  arg = queue_args_encode(L, 3, lua_toboolean(L, 4), queue);
+  if(!arg) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  THCharStorage_retain(callback); /* the queue now holds a reference */
+  status = THQueue_push(queue, callback, arg);
+  lua_pushboolean(L, 1);
+  if(status) {
+    THCharStorage_free(callback);
+    queue_args_discard(L, arg);
+    if(status != THQUEUE_CLOSED)
+      luaL_error(L, "threads: queue push failed");
+    lua_pushnil(L);
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 2;
+}
 
-static int queue_set_head(lua_State *L)
+/* like pushargs, without waiting: returns false if the arguments are not
+   flat, true and then whether the queue had room (nil if it is closed)
+   otherwise */
+static int queue_trypushargs(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  int value = luaL_checkint(L, 2);
-  queue->head = value;
-  return 0;
+  THCharStorage *callback = luaT_checkudata(L, 2, "torch.CharStorage");
+  THCharStorage *arg;
+  int status;
+  luaL_checktype(L, 3, LUA_TTABLE);
+  arg = queue_args_encode(L, 3, lua_toboolean(L, 4), queue);
+  if(!arg) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  THCharStorage_retain(callback);
+  lua_pushboolean(L, 1);
+  status = THQueue_trypush(queue, callback, arg);
+  if(status == 1) {
+    lua_pushboolean(L, 1);
+    return 2;
+  }
+  THCharStorage_free(callback);
+  queue_args_discard(L, arg);
+  if(status == THQUEUE_CLOSED)
+    lua_pushnil(L);
+  else
+    lua_pushboolean(L, 0);
+  return 2;
 }
 
-static int queue_set_tail(lua_State *L)
+/* gives back a storage which has been read, for later jobs */
+static int queue_recycle(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  int value = luaL_checkint(L, 2);
-  queue->tail = value;
+  THCharStorage *storage = luaT_checkudata(L, 2, "torch.CharStorage");
+  THCharStorage_retain(storage); /* the lua reference goes away with the gc */
+  THQueue_putbuffer(queue, storage);
   return 0;
 }
 
-static int queue_set_isempty(lua_State *L)
+/* snapshot of the counters of the queue (see THQueueStats) */
+static int queue_stats(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  int value = luaL_checkint(L, 2);
-  queue->isempty = value;
-  return 0;
+  THQueueStats stats;
+  THQueue_stats(queue, &stats);
+  lua_createtable(L, 0, 10);
+  lua_pushnumber(L, THQueue_size(queue));
+  lua_setfield(L, -2, "size");
+  lua_pushnumber(L, stats.enqueued);
+  lua_setfield(L, -2, "enqueued");
+  lua_pushnumber(L, stats.dequeued);
+  lua_setfield(L, -2, "dequeued");
+  lua_pushnumber(L, stats.depth);
+  lua_setfield(L, -2, "depth");
+  lua_pushnumber(L, stats.maxdepth);
+  lua_setfield(L, -2, "maxdepth");
+  lua_pushnumber(L, stats.nblockedfull);
+  lua_setfield(L, -2, "nblockedfull");
+  lua_pushnumber(L, stats.nblockedempty);
+  lua_setfield(L, -2, "nblockedempty");
+  lua_pushnumber(L, stats.blockedfull);
+  lua_setfield(L, -2, "blockedfull");
+  lua_pushnumber(L, stats.blockedempty);
+  lua_setfield(L, -2, "blockedempty");
+  lua_pushnumber(L, stats.nallocated);
+  lua_setfield(L, -2, "nallocated");
+  return 1;
 }
 
-static int queue_set_isfull(lua_State *L)
+static int queue_close(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  int value = luaL_checkint(L, 2);
-  queue->isfull = value;
+  THQueue_close(queue);
   return 0;
 }
 
-static int queue__newindex(lua_State *L)
+static int queue_popmany(lua_State *L)
 {
-  luaTHRD_checkudata(L, 1, "threads.Queue");
-  if(lua_gettop(L) != 3)
-    luaL_error(L, "invalid arguments");
+  THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
+  int max = luaL_optint(L, 2, THQueue_size(queue));
+  THCharStorage **storages = NULL;
+  int n, i;
+  luaL_argcheck(L, max > 0, 2, "positive number of jobs expected");
+  storages = malloc(2*max*sizeof(THCharStorage*));
+  if(!storages)
+    luaL_error(L, "threads: queue popmany out of memory");
+  n = THQueue_popmany(queue, max, storages, storages+max);
+  if(n < 0) {
+    free(storages);
+    luaL_error(L, "threads: queue popmany failed");
+  }
+  lua_createtable(L, n, 0);
+  lua_createtable(L, n, 0);
+  for(i = 0; i < n; i++) {
+    luaT_pushudata(L, storages[i], "torch.CharStorage");
+    lua_rawseti(L, -3, i+1);
+    queue_pusharg(L, queue, storages[max+i]);
+    lua_rawseti(L, -2, i+1);
+  }
+  free(storages);
+  return 2;
+}
 
-  lua_getmetatable(L, 1);
-  if(lua_isstring(L, 2)) {
-    lua_pushstring(L, "__set");
-    lua_rawget(L, -2);
-    lua_pushvalue(L, 2);
-    lua_rawget(L, -2);
-    if(lua_isfunction(L, -1)) {
-      lua_pushvalue(L, 1);
-      lua_pushvalue(L, 3);
-      lua_call(L, 2, 0);
-      return 0;
+/* one waiter per lua state (hence per thread), created on first use */
+static THQueueWaiter* queue_waiter(lua_State *L)
+{
+  THQueueWaiter *waiter = NULL;
+  lua_getfield(L, LUA_REGISTRYINDEX, "threads.Queue.waiter");
+  if(lua_isuserdata(L, -1))
+    waiter = luaTHRD_toudata(L, -1, "threads.QueueWaiter");
+  lua_pop(L, 1);
+  if(!waiter) {
+    waiter = THQueueWaiter_new();
+    if(!waiter)
+      luaL_error(L, "threads: queue waiter out of memory");
+    if(!luaTHRD_pushudata(L, waiter, "threads.QueueWaiter")) {
+      THQueueWaiter_free(waiter);
+      luaL_error(L, "threads: queue waiter out of memory");
     }
-    else
-      luaL_error(L, "invalid argument");
+    lua_setfield(L, LUA_REGISTRYINDEX, "threads.Queue.waiter");
   }
-  luaL_error(L, "invalid argument");
+  return waiter;
+}
+
+static int queue_waiter_free(lua_State *L)
+{
+  THQueueWaiter *waiter = luaTHRD_checkudata(L, 1, "threads.QueueWaiter");
+  THQueueWaiter_free(waiter);
   return 0;
 }
 
+/* array of queues from a lua table (kept alive on the stack) */
+static THQueue** queue_checkqueues(lua_State *L, int narg, int *n)
+{
+  THQueue **queues;
+  int i;
+  luaL_checktype(L, narg, LUA_TTABLE);
+  *n = (int)lua_objlen(L, narg);
+  luaL_argcheck(L, *n > 0, narg, "non-empty table of queues expected");
+  queues = lua_newuserdata(L, (*n)*sizeof(THQueue*));
+  for(i = 0; i < *n; i++) {
+    lua_rawgeti(L, narg, i+1);
+    queues[i] = luaTHRD_toudata(L, -1, "threads.Queue");
+    if(!queues[i])
+      luaL_argerror(L, narg, "table of queues expected");
+    lua_pop(L, 1);
+  }
+  return queues;
+}
+
+static int queue_selectqueues(lua_State *L, int block)
+{
+  int n, idx;
+  THQueue **queues = queue_checkqueues(L, 1, &n);
+  int start = luaL_optint(L, 2, 1);
+  double timeout = luaL_optnumber(L, 3, -1);
+  THQueueWaiter *waiter = (block ? queue_waiter(L) : NULL);
+  THCharStorage *callback = NULL;
+  THCharStorage *arg = NULL;
+  idx = THQueue_timedselect(queues, n, start-1, waiter, timeout, &callback, &arg);
+  if(idx == -2)
+    luaL_error(L, "threads: queue select failed");
+  if(idx < 0)
+    return 0;
+  lua_pushinteger(L, idx+1);
+  luaT_pushudata(L, callback, "torch.CharStorage"); /* reference handed over to lua */
+  queue_pusharg(L, queues[idx], arg);
+  return 3;
+}
+
+static int queue_select(lua_State *L)
+{
+  return queue_selectqueues(L, 1);
+}
+
+static int queue_tryselect(lua_State *L)
+{
+  return queue_selectqueues(L, 0);
+}
+
+/* waits for a job in any of the queues, then takes whatever else is ready (up to max) */
+static int queue_selectmany(lua_State *L)
+{
+  int n, idx, i;
+  THQueue **queues = queue_checkqueues(L, 1, &n);
+  int max = luaL_optint(L, 2, 0);
+  int start = luaL_optint(L, 3, 1);
+  THQueueWaiter *waiter = queue_waiter(L);
+  THCharStorage *callback = NULL;
+  THCharStorage *arg = NULL;
+  if(max <= 0)
+    for(i = 0; i < n; i++)
+      max += THQueue_size(queues[i]);
+  lua_newtable(L); /* indices */
+  lua_newtable(L); /* callbacks */
+  lua_newtable(L); /* args */
+  for(i = 0; i < max; i++) {
+    idx = THQueue_select(queues, n, start-1, (i == 0 ? waiter : NULL), &callback, &arg);
+    if(idx == -2)
+      luaL_error(L, "threads: queue select failed");
+    if(idx < 0)
+      break;
+    start = idx+1; /* drain that queue first */
+    lua_pushinteger(L, idx+1);
+    lua_rawseti(L, -4, i+1);
+    luaT_pushudata(L, callback, "torch.CharStorage");
+    lua_rawseti(L, -3, i+1);
+    queue_pusharg(L, queues[idx], arg);
+    lua_rawseti(L, -2, i+1);
+  }
+  return 3;
+}
+
 static int queue_id(lua_State *L)
 {
   THQueue *queue = luaTHRD_checkudata(L, 1, "threads.Queue");
-  lua_pushinteger(L, (AddressType)queue);
+  lua_pushinteger(L, THQueue_id(queue));
   return 1;
 }
 
@@ -329,11 +789,22 @@ static const struct luaL_Reg queue__ [] = {
   {"id", queue_id},
   {"retain", queue_retain},
   {"free", queue_free},
-  {"callback", queue_callback},
-  {"arg", queue_arg},
+  {"push", queue_push},
+  {"pop", queue_pop},
+  {"popmany", queue_popmany},
+  {"trypush", queue_trypush},
+  {"pushargs", queue_pushargs},
+  {"trypushargs", queue_trypushargs},
+  {"recycle", queue_recycle},
+  {"close", queue_close},
+  {"stats", queue_stats},
+  {"select", queue_select},
+  {"tryselect", queue_tryselect},
+  {"selectmany", queue_selectmany},
+  {"packargs", queue_packargs},
+  {"unpackargs", queue_unpackargs},
   {"__gc", queue_free},
   {"__index", queue__index},
-  {"__newindex", queue__newindex},
   {NULL, NULL}
 };
 
@@ -342,22 +813,16 @@ static const struct luaL_Reg queue_get__ [] = {
   {"notfull", queue_get_notfull},
   {"notempty", queue_get_notempty},
   {"serialize", queue_get_serialize},
+  {"info", queue_get_info},
   {"head", queue_get_head},
   {"tail", queue_get_tail},
   {"isempty", queue_get_isempty},
   {"isfull", queue_get_isfull},
+  {"isclosed", queue_get_isclosed},
   {"size", queue_get_size},
   {NULL, NULL}
 };
 
-static const struct luaL_Reg queue_set__ [] = {
-  {"head", queue_set_head},
-  {"tail", queue_set_tail},
-  {"isempty", queue_set_isempty},
-  {"isfull", queue_set_isfull},
-  {NULL, NULL}
-};
-
 static void queue_init_pkg(lua_State *L)
 {
   if(!luaL_newmetatable(L, "threads.Queue"))
@@ -369,11 +834,12 @@ static void queue_init_pkg(lua_State *L)
   luaL_setfuncs(L, queue_get__, 0);
   lua_rawset(L, -3);
 
-  lua_pushstring(L, "__set");
-  lua_newtable(L);
-  luaL_setfuncs(L, queue_set__, 0);
-  lua_rawset(L, -3);
+  lua_pop(L, 1);
 
+  if(!luaL_newmetatable(L, "threads.QueueWaiter"))
+    luaL_error(L, "threads: threads.QueueWaiter type already exists");
+  lua_pushcfunction(L, queue_waiter_free);
+  lua_setfield(L, -2, "__gc");
   lua_pop(L, 1);
 
   lua_pushstring(L, "Queue");
@@ -10,12 +10,58 @@
 #include <lua.h>
 #include <lualib.h>
 
+/* thread attributes from an optional table {stacksize=, cpus={...}, numanode=}
+   (the cpus array is a userdata left on the stack) */
+static void thread_checkattr(lua_State *L, int narg, THThreadAttr *attr)
+{
+  attr->stacksize = 0;
+  attr->ncpus = 0;
+  attr->cpus = NULL;
+  attr->numanode = -1;
+  if(lua_isnoneornil(L, narg))
+    return;
+  luaL_checktype(L, narg, LUA_TTABLE);
+
+  lua_getfield(L, narg, "stacksize");
+  if(!lua_isnil(L, -1)) {
+    luaL_argcheck(L, lua_isnumber(L, -1) && lua_tonumber(L, -1) > 0, narg, "positive stacksize expected");
+    attr->stacksize = (long)lua_tonumber(L, -1);
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, narg, "numanode");
+  if(!lua_isnil(L, -1)) {
+    luaL_argcheck(L, lua_isnumber(L, -1) && lua_tonumber(L, -1) >= 0, narg, "non-negative numanode expected");
+    attr->numanode = (int)lua_tonumber(L, -1);
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, narg, "cpus");
+  if(!lua_isnil(L, -1)) {
+    int i;
+    luaL_argcheck(L, lua_istable(L, -1), narg, "table of cpus expected");
+    attr->ncpus = (int)lua_objlen(L, -1);
+    attr->cpus = lua_newuserdata(L, (attr->ncpus > 0 ? attr->ncpus : 1)*sizeof(int));
+    lua_insert(L, -2);
+    for(i = 0; i < attr->ncpus; i++) {
+      lua_rawgeti(L, -1, i+1);
+      luaL_argcheck(L, lua_isnumber(L, -1) && lua_tonumber(L, -1) >= 0, narg, "non-negative cpu numbers expected");
+      attr->cpus[i] = (int)lua_tonumber(L, -1);
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+}
+
 static int thread_new(lua_State *L)
 {
   THThread *thread = NULL;
+  THThreadAttr attr;
   size_t len = 0;
   const char *code = luaL_checklstring(L, 1, &len);
-  char *code_dup = malloc(len+1);
+  char *code_dup = NULL;
+  thread_checkattr(L, 2, &attr);
+  code_dup = malloc(len+1);
   if(!code_dup)
     luaL_error(L, "threads: out of memory");
   memcpy(code_dup, code, len+1);
@@ -43,7 +89,7 @@ static int thread_new(lua_State *L)
     luaL_error(L, "threads: dlsym: %s", dlerror());
   }
 
-  thread = THThread_new(thread_main, (void*)code_dup);
+  thread = THThread_newWithAttr(thread_main, (void*)code_dup, &attr);
   if(!thread) {
     free(code_dup);
     luaL_error(L, "threads: thread new failed");
@@ -86,6 +132,14 @@ static int mutex_new(lua_State *L)
   if(lua_gettop(L) == 0) {
     mutex = THMutex_new();
   }
+  else if(lua_gettop(L) == 1 && lua_istable(L, 1)) {
+    int flags = 0;
+    lua_getfield(L, 1, "adaptive");
+    if(lua_toboolean(L, -1))
+      flags |= THMUTEX_ADAPTIVE;
+    lua_pop(L, 1);
+    mutex = THMutex_newWithFlags(flags);
+  }
   else if(lua_gettop(L) == 1) {
     AddressType id = luaL_checkaddr(L, 1);
     mutex = THMutex_newWithId(id);
@@ -134,6 +188,13 @@ static int mutex_unlock(lua_State *L)
   return 0;
 }
 
+static int mutex_isadaptive(lua_State *L)
+{
+  THMutex *mutex = luaTHRD_checkudata(L, 1, "threads.Mutex");
+  lua_pushboolean(L, THMutex_isadaptive(mutex));
+  return 1;
+}
+
 static int mutex_free(lua_State *L)
 {
   THMutex *mutex = luaTHRD_checkudata(L, 1, "threads.Mutex");
@@ -141,6 +202,75 @@ static int mutex_free(lua_State *L)
   return 0;
 }
 
+static int rwlock_new(lua_State *L)
+{
+  THRWLock *rwlock = NULL;
+  if(lua_gettop(L) == 0) {
+    rwlock = THRWLock_new();
+  }
+  else if(lua_gettop(L) == 1) {
+    AddressType id = luaL_checkaddr(L, 1);
+    rwlock = THRWLock_newWithId(id);
+  }
+  else
+    luaL_error(L, "threads: rwlock new invalid arguments");
+  if(!rwlock)
+    luaL_error(L, "threads: rwlock new failed");
+  luaTHRD_pushudata(L, rwlock, "threads.RWLock");
+  return 1;
+}
+
+static int rwlock_tostring(lua_State *L)
+{
+  char str[128];
+  THRWLock *rwlock = luaTHRD_checkudata(L, 1, "threads.RWLock");
+#ifndef _WIN64
+  snprintf(str, 128, "threads.RWLock <%lx>", THRWLock_id(rwlock));
+#else
+  snprintf(str, 128, "threads.RWLock <%llx>", THRWLock_id(rwlock));
+#endif
+  lua_pushstring(L, str);
+  return 1;
+}
+
+static int rwlock_id(lua_State *L)
+{
+  THRWLock *rwlock = luaTHRD_checkudata(L, 1, "threads.RWLock");
+  lua_pushinteger(L, THRWLock_id(rwlock));
+  return 1;
+}
+
+static int rwlock_rdlock(lua_State *L)
+{
+  THRWLock *rwlock = luaTHRD_checkudata(L, 1, "threads.RWLock");
+  if(THRWLock_rdlock(rwlock))
+    luaL_error(L, "threads: rwlock rdlock failed");
+  return 0;
+}
+
+static int rwlock_wrlock(lua_State *L)
+{
+  THRWLock *rwlock = luaTHRD_checkudata(L, 1, "threads.RWLock");
+  if(THRWLock_wrlock(rwlock))
+    luaL_error(L, "threads: rwlock wrlock failed");
+  return 0;
+}
+
+static int rwlock_unlock(lua_State *L)
+{
+  THRWLock *rwlock = luaTHRD_checkudata(L, 1, "threads.RWLock");
+  if(THRWLock_unlock(rwlock))
+    luaL_error(L, "threads: rwlock unlock failed");
+  return 0;
+}
+
+static int rwlock_free(lua_State *L)
+{
+  THRWLock *rwlock = luaTHRD_checkudata(L, 1, "threads.RWLock");
+  THRWLock_free(rwlock);
+  return 0;
+}
+
 static int condition_new(lua_State *L)
 {
   THCondition *condition = NULL;
@@ -195,6 +325,14 @@ static int condition_signal(lua_State *L)
   return 0;
 }
 
+static int condition_broadcast(lua_State *L)
+{
+  THCondition *condition = luaTHRD_checkudata(L, 1, "threads.Condition");
+  if(THCondition_broadcast(condition))
+    luaL_error(L, "threads: condition broadcast failed");
+  return 0;
+}
+
 static int condition_wait(lua_State *L)
 {
   THCondition *condition = luaTHRD_checkudata(L, 1, "threads.Condition");
@@ -204,6 +342,331 @@ static int condition_wait(lua_State *L)
   return 0;
 }
 
+/* returns false if the timeout (in seconds) elapsed */
+static int condition_timedwait(lua_State *L)
+{
+  THCondition *condition = luaTHRD_checkudata(L, 1, "threads.Condition");
+  THMutex *mutex = luaTHRD_checkudata(L, 2, "threads.Mutex");
+  double timeout = luaL_checknumber(L, 3);
+  int status = THCondition_timedwait(condition, mutex, timeout);
+  if(status == 1)
+    luaL_error(L, "threads: condition timedwait failed");
+  lua_pushboolean(L, status != THTHREAD_TIMEDOUT);
+  return 1;
+}
+
+static int semaphore_new(lua_State *L)
+{
+  THSemaphore *semaphore = NULL;
+  if(lua_gettop(L) == 0) {
+    semaphore = THSemaphore_new(0);
+  }
+  else if(lua_gettop(L) == 1) {
+    AddressType id = luaL_checkaddr(L, 1);
+    semaphore = THSemaphore_newWithId(id);
+  }
+  else
+    luaL_error(L, "threads: semaphore new invalid arguments");
+  if(!semaphore)
+    luaL_error(L, "threads: semaphore new failed");
+  luaTHRD_pushudata(L, semaphore, "threads.Semaphore");
+  return 1;
+}
+
+static int semaphore_tostring(lua_State *L)
+{
+  char str[128];
+  THSemaphore *semaphore = luaTHRD_checkudata(L, 1, "threads.Semaphore");
+#ifndef _WIN64
+  snprintf(str, 128, "threads.Semaphore <%lx>", THSemaphore_id(semaphore));
+#else
+  snprintf(str, 128, "threads.Semaphore <%llx>", THSemaphore_id(semaphore));
+#endif
+  lua_pushstring(L, str);
+  return 1;
+}
+
+static int semaphore_id(lua_State *L)
+{
+  THSemaphore *semaphore = luaTHRD_checkudata(L, 1, "threads.Semaphore");
+  lua_pushinteger(L, THSemaphore_id(semaphore));
+  return 1;
+}
+
+static int semaphore_value(lua_State *L)
+{
+  THSemaphore *semaphore = luaTHRD_checkudata(L, 1, "threads.Semaphore");
+  lua_pushinteger(L, THSemaphore_value(semaphore));
+  return 1;
+}
+
+static int semaphore_post(lua_State *L)
+{
+  THSemaphore *semaphore = luaTHRD_checkudata(L, 1, "threads.Semaphore");
+  int n = luaL_optint(L, 2, 1);
+  if(THSemaphore_post(semaphore, n))
+    luaL_error(L, "threads: semaphore post failed");
+  return 0;
+}
+
+static int semaphore_wait(lua_State *L)
+{
+  THSemaphore *semaphore = luaTHRD_checkudata(L, 1, "threads.Semaphore");
+  if(THSemaphore_wait(semaphore))
+    luaL_error(L, "threads: semaphore wait failed");
+  return 0;
+}
+
+static int semaphore_trywait(lua_State *L)
+{
+  THSemaphore *semaphore = luaTHRD_checkudata(L, 1, "threads.Semaphore");
+  lua_pushboolean(L, THSemaphore_trywait(semaphore));
+  return 1;
+}
+
+/* returns false if the timeout (in seconds) elapsed */
+static int semaphore_timedwait(lua_State *L)
+{
+  THSemaphore *semaphore = luaTHRD_checkudata(L, 1, "threads.Semaphore");
+  double timeout = luaL_checknumber(L, 2);
+  int status = THSemaphore_timedwait(semaphore, timeout);
+  if(status == 1)
+    luaL_error(L, "threads: semaphore timedwait failed");
+  lua_pushboolean(L, status != THTHREAD_TIMEDOUT);
+  return 1;
+}
+
+static int semaphore_free(lua_State *L)
+{
+  THSemaphore *semaphore = luaTHRD_checkudata(L, 1, "threads.Semaphore");
+  THSemaphore_free(semaphore);
+  return 0;
+}
+
+static int barrier_new(lua_State *L)
+{
+  THBarrier *barrier = NULL;
+  if(lua_gettop(L) == 1 && lua_istable(L, 1)) {
+    int count;
+    lua_getfield(L, 1, "count");
+    luaL_argcheck(L, lua_isnumber(L, -1) && lua_tonumber(L, -1) >= 1, 1, "positive count expected");
+    count = (int)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    barrier = THBarrier_new(count);
+  }
+  else if(lua_gettop(L) == 1) {
+    AddressType id = luaL_checkaddr(L, 1);
+    barrier = THBarrier_newWithId(id);
+  }
+  else
+    luaL_error(L, "threads: barrier new invalid arguments");
+  if(!barrier)
+    luaL_error(L, "threads: barrier new failed");
+  luaTHRD_pushudata(L, barrier, "threads.Barrier");
+  return 1;
+}
+
+static int barrier_tostring(lua_State *L)
+{
+  char str[128];
+  THBarrier *barrier = luaTHRD_checkudata(L, 1, "threads.Barrier");
+#ifndef _WIN64
+  snprintf(str, 128, "threads.Barrier <%lx>", THBarrier_id(barrier));
+#else
+  snprintf(str, 128, "threads.Barrier <%llx>", THBarrier_id(barrier));
+#endif
+  lua_pushstring(L, str);
+  return 1;
+}
+
+static int barrier_id(lua_State *L)
+{
+  THBarrier *barrier = luaTHRD_checkudata(L, 1, "threads.Barrier");
+  lua_pushinteger(L, THBarrier_id(barrier));
+  return 1;
+}
+
+static int barrier_count(lua_State *L)
+{
+  THBarrier *barrier = luaTHRD_checkudata(L, 1, "threads.Barrier");
+  lua_pushinteger(L, THBarrier_count(barrier));
+  return 1;
+}
+
+/* returns true in the last thread to arrive */
+static int barrier_wait(lua_State *L)
+{
+  THBarrier *barrier = luaTHRD_checkudata(L, 1, "threads.Barrier");
+  int status = THBarrier_wait(barrier);
+  if(status == 1)
+    luaL_error(L, "threads: barrier wait failed");
+  lua_pushboolean(L, status == THBARRIER_LAST);
+  return 1;
+}
+
+static int barrier_free(lua_State *L)
+{
+  THBarrier *barrier = luaTHRD_checkudata(L, 1, "threads.Barrier");
+  THBarrier_free(barrier);
+  return 0;
+}
+
+static int atomic_new(lua_State *L)
+{
+  THAtomic *atomic = NULL;
+  if(lua_gettop(L) == 0) {
+    atomic = THAtomic_new(0);
+  }
+  else if(lua_gettop(L) == 1 && lua_istable(L, 1)) {
+    int isdouble;
+    lua_Number value;
+    lua_getfield(L, 1, "double");
+    isdouble = lua_toboolean(L, -1);
+    lua_getfield(L, 1, "value");
+    luaL_argcheck(L, lua_isnil(L, -1) || lua_isnumber(L, -1), 1, "number expected for value");
+    value = lua_tonumber(L, -1);
+    lua_pop(L, 2);
+    atomic = (isdouble ? THAtomic_newDouble((double)value) : THAtomic_new((int64_t)value));
+  }
+  else if(lua_gettop(L) == 1) {
+    AddressType id = luaL_checkaddr(L, 1);
+    atomic = THAtomic_newWithId(id);
+  }
+  else
+    luaL_error(L, "threads: atomic new invalid arguments");
+  if(!atomic)
+    luaL_error(L, "threads: atomic new failed");
+  luaTHRD_pushudata(L, atomic, "threads.Atomic");
+  return 1;
+}
+
+static int atomic_tostring(lua_State *L)
+{
+  char str[128];
+  THAtomic *atomic = luaTHRD_checkudata(L, 1, "threads.Atomic");
+#ifndef _WIN64
+  snprintf(str, 128, "threads.Atomic <%lx>", THAtomic_id(atomic));
+#else
+  snprintf(str, 128, "threads.Atomic <%llx>", THAtomic_id(atomic));
+#endif
+  lua_pushstring(L, str);
+  return 1;
+}
+
+static int atomic_id(lua_State *L)
+{
+  THAtomic *atomic = luaTHRD_checkudata(L, 1, "threads.Atomic");
+  lua_pushinteger(L, THAtomic_id(atomic));
+  return 1;
+}
+
+static int atomic_isdouble(lua_State *L)
+{
+  THAtomic *atomic = luaTHRD_checkudata(L, 1, "threads.Atomic");
+  lua_pushboolean(L, THAtomic_isdouble(atomic));
+  return 1;
+}
+
+/* integer values stay integers on Lua 5.3+ */
+static void atomic_pushinteger(lua_State *L, int64_t value)
+{
+#if LUA_VERSION_NUM >= 503
+  lua_pushinteger(L, (lua_Integer)value);
+#else
+  lua_pushnumber(L, (lua_Number)value);
+#endif
+}
+
+static int atomic_get(lua_State *L)
+{
+  THAtomic *atomic = luaTHRD_checkudata(L, 1, "threads.Atomic");
+  if(THAtomic_isdouble(atomic))
+    lua_pushnumber(L, (lua_Number)THAtomic_getDouble(atomic));
+  else
+    atomic_pushinteger(L, THAtomic_get(atomic));
+  return 1;
+}
+
+static int atomic_set(lua_State *L)
+{
+  THAtomic *atomic = luaTHRD_checkudata(L, 1, "threads.Atomic");
+  lua_Number value = luaL_checknumber(L, 2);
+  if(THAtomic_isdouble(atomic))
+    THAtomic_setDouble(atomic, (double)value);
+  else
+    THAtomic_set(atomic, (int64_t)value);
+  return 0;
+}
+
+/* adds sign*n (n being 1 by default), and returns the value before */
+static int atomic_addsigned(lua_State *L, int sign)
+{
+  THAtomic *atomic = luaTHRD_checkudata(L, 1, "threads.Atomic");
+  lua_Number value = luaL_optnumber(L, 2, 1);
+  if(THAtomic_isdouble(atomic))
+    lua_pushnumber(L, (lua_Number)THAtomic_addDouble(atomic, sign*(double)value));
+  else
+    atomic_pushinteger(L, THAtomic_add(atomic, sign*(int64_t)value));
+  return 1;
+}
+
+static int atomic_add(lua_State *L)
+{
+  return atomic_addsigned(L, 1);
+}
+
+static int atomic_sub(lua_State *L)
+{
+  return atomic_addsigned(L, -1);
+}
+
+/* sets the value, and returns the value before */
+static int atomic_exchange(lua_State *L)
+{
+  THAtomic *atomic = luaTHRD_checkudata(L, 1, "threads.Atomic");
+  lua_Number value = luaL_checknumber(L, 2);
+  if(THAtomic_isdouble(atomic))
+    lua_pushnumber(L, (lua_Number)THAtomic_exchangeDouble(atomic, (double)value));
+  else
+    atomic_pushinteger(L, THAtomic_exchange(atomic, (int64_t)value));
+  return 1;
+}
+
+/* sets the value to desired if it is expected; returns true if it did, and
+   the value before */
+static int atomic_cas(lua_State *L)
+{
+  THAtomic *atomic = luaTHRD_checkudata(L, 1, "threads.Atomic");
+  lua_Number expected = luaL_checknumber(L, 2);
+  lua_Number desired = luaL_checknumber(L, 3);
+  if(THAtomic_isdouble(atomic)) {
+    double oldvalue = (double)expected;
+    double previous = THAtomic_compareAndSwapDouble(atomic, oldvalue, (double)desired);
+    lua_pushboolean(L, memcmp(&previous, &oldvalue, sizeof(double)) == 0); /* bitwise, like the swap */
+    lua_pushnumber(L, (lua_Number)previous);
+  }
+  else {
+    int64_t previous = THAtomic_compareAndSwap(atomic, (int64_t)expected, (int64_t)desired);
+    lua_pushboolean(L, previous == (int64_t)expected);
+    atomic_pushinteger(L, previous);
+  }
+  return 2;
+}
+
+static int atomic_free(lua_State *L)
+{
+  THAtomic *atomic = luaTHRD_checkudata(L, 1, "threads.Atomic");
+  THAtomic_free(atomic);
+  return 0;
+}
+
+/* monotonic time, in seconds */
+static int thread_now(lua_State *L)
+{
+  lua_pushnumber(L, THThread_now());
+  return 1;
+}
+
 static const struct luaL_Reg thread__ [] = {
   {"new", thread_new},
   {"__tostring", thread_tostring},
@@ -218,20 +681,74 @@ static const struct luaL_Reg mutex__ [] = {
   {"id", mutex_id},
   {"lock", mutex_lock},
   {"unlock", mutex_unlock},
+  {"isadaptive", mutex_isadaptive},
   {"free", mutex_free},
   {NULL, NULL}
 };
 
+static const struct luaL_Reg rwlock__ [] = {
+  {"new", rwlock_new},
+  {"__tostring", rwlock_tostring},
+  {"id", rwlock_id},
+  {"rdlock", rwlock_rdlock},
+  {"wrlock", rwlock_wrlock},
+  {"unlock", rwlock_unlock},
+  {"free", rwlock_free},
+  {NULL, NULL}
+};
+
 static const struct luaL_Reg condition__ [] = {
   {"new", condition_new},
   {"__tostring", condition_tostring},
   {"id", condition_id},
   {"signal", condition_signal},
+  {"broadcast", condition_broadcast},
   {"wait", condition_wait},
+  {"timedwait", condition_timedwait},
   {"free", condition_free},
   {NULL, NULL}
 };
 
+static const struct luaL_Reg semaphore__ [] = {
+  {"new", semaphore_new},
+  {"__tostring", semaphore_tostring},
+  {"id", semaphore_id},
+  {"value", semaphore_value},
+  {"post", semaphore_post},
+  {"wait", semaphore_wait},
+  {"trywait", semaphore_trywait},
+  {"timedwait", semaphore_timedwait},
+  {"free", semaphore_free},
+  {NULL, NULL}
+};
+
+static const struct luaL_Reg barrier__ [] = {
+  {"new", barrier_new},
+  {"__tostring", barrier_tostring},
+  {"id", barrier_id},
+  {"count", barrier_count},
+  {"wait", barrier_wait},
+  {"free", barrier_free},
+  {NULL, NULL}
+};
+
+static const struct luaL_Reg atomic__ [] = {
+  {"new", atomic_new},
+  {"__tostring", atomic_tostring},
+  {"id", atomic_id},
+  {"isdouble", atomic_isdouble},
+  {"get", atomic_get},
+  {"set", atomic_set},
+  {"load", atomic_get},
+  {"store", atomic_set},
+  {"add", atomic_add},
+  {"sub", atomic_sub},
+  {"exchange", atomic_exchange},
+  {"cas", atomic_cas},
+  {"free", atomic_free},
+  {NULL, NULL}
+};
+
 static void thread_init_pkg(lua_State *L)
 {
   if(!luaL_newmetatable(L, "threads.Thread"))
@@ -250,6 +767,14 @@ static void thread_init_pkg(lua_State *L)
   lua_rawset(L, -3);
   lua_pop(L, 1);
 
+  if(!luaL_newmetatable(L, "threads.RWLock"))
+    luaL_error(L, "threads: threads.RWLock type already exists");
+  luaL_setfuncs(L, rwlock__, 0);
+  lua_pushstring(L, "__index");
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+
   if(!luaL_newmetatable(L, "threads.Condition"))
     luaL_error(L, "threads: threads.Condition type already exists");
   luaL_setfuncs(L, condition__, 0);
@@ -258,15 +783,59 @@ static void thread_init_pkg(lua_State *L)
   lua_rawset(L, -3);
   lua_pop(L, 1);
 
+  if(!luaL_newmetatable(L, "threads.Semaphore"))
+    luaL_error(L, "threads: threads.Semaphore type already exists");
+  luaL_setfuncs(L, semaphore__, 0);
+  lua_pushstring(L, "__index");
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+
+  if(!luaL_newmetatable(L, "threads.Barrier"))
+    luaL_error(L, "threads: threads.Barrier type already exists");
+  luaL_setfuncs(L, barrier__, 0);
+  lua_pushstring(L, "__index");
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+
+  if(!luaL_newmetatable(L, "threads.Atomic"))
+    luaL_error(L, "threads: threads.Atomic type already exists");
+  luaL_setfuncs(L, atomic__, 0);
+  lua_pushstring(L, "__index");
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+
   lua_pushstring(L, "Thread");
   luaTHRD_pushctortable(L, thread_new, "threads.Thread");
   lua_rawset(L, -3);
 
+  lua_pushstring(L, "now");
+  lua_pushcfunction(L, thread_now);
+  lua_rawset(L, -3);
+
   lua_pushstring(L, "Mutex");
   luaTHRD_pushctortable(L, mutex_new, "threads.Mutex");
   lua_rawset(L, -3);
 
+  lua_pushstring(L, "RWLock");
+  luaTHRD_pushctortable(L, rwlock_new, "threads.RWLock");
+  lua_rawset(L, -3);
+
   lua_pushstring(L, "Condition");
   luaTHRD_pushctortable(L, condition_new, "threads.Condition");
   lua_rawset(L, -3);
+
+  lua_pushstring(L, "Semaphore");
+  luaTHRD_pushctortable(L, semaphore_new, "threads.Semaphore");
+  lua_rawset(L, -3);
+
+  lua_pushstring(L, "Barrier");
+  luaTHRD_pushctortable(L, barrier_new, "threads.Barrier");
+  lua_rawset(L, -3);
+
+  lua_pushstring(L, "Atomic");
+  luaTHRD_pushctortable(L, atomic_new, "threads.Atomic");
+  lua_rawset(L, -3);
 }
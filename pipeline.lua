@@ -0,0 +1,344 @@
+-- Chains of stages (e.g. read, decode, augment, batch), each run by its own
+-- pool, connected by bounded channels. Each thread of a stage runs a single
+-- job, which takes the items from the channel of the previous stage and
+-- sends its results to the channel of the next one, until the former is
+-- closed and empty. The output channel grows instead, so that the stages
+-- never wait for the caller. Items carry a sequence number (given by
+-- push()), so that the output can be put back in order.
+
+local Threads = require 'threads.threads'
+local Channel = require 'threads.channel'
+local clib = require 'libthreads'
+local now = clib.now
+local _unpack = unpack or table.unpack
+
+local Pipeline = {}
+Pipeline.__index = Pipeline
+
+setmetatable(
+   Pipeline, {
+      __call =
+         function(self, ...)
+            return Pipeline.new(...)
+         end
+   }
+)
+
+-- counters of each stage, summed over its threads (times in microseconds)
+local counters = {'items', 'busy', 'idle', 'blocked'}
+
+-- the job of each thread of a stage (serialized: no upvalues); messages
+-- are (seq, values...), an item dropped by a stage being (seq) alone
+local function runstage(func, batch, ordered, ids)
+   local threads = require 'threads'
+   local now = threads.now
+   local _unpack = unpack or table.unpack
+   local input = threads.Channel.attach(ids.input)
+   local output = threads.Channel.attach(ids.output)
+   local running = threads.Atomic(ids.running)
+   local counters = {}
+   for _, name in ipairs{'items', 'busy', 'idle', 'blocked'} do
+      counters[name] = threads.Atomic(ids[name])
+   end
+
+   local function pack(...)
+      return {n=select('#', ...), ...}
+   end
+
+   local function elapsed(counter, start)
+      local t = now()
+      counter:add(math.floor((t - start)*1e6))
+      return t
+   end
+
+   local function recv()
+      local t = now()
+      local msg = pack(input:recv())
+      elapsed(counters.idle, t)
+      if msg.n > 0 then
+         return msg
+      end
+   end
+
+   local function send(seq, res)
+      local t = now()
+      output:send(seq, _unpack(res, 1, res.n))
+      elapsed(counters.blocked, t)
+   end
+
+   local function run(...)
+      local t = now()
+      local res = pack(func(...))
+      elapsed(counters.busy, t)
+      return res
+   end
+
+   local function loop()
+      if not batch then
+         for msg in recv do
+            if msg.n > 1 then
+               counters.items:add(1)
+               send(msg[1], run(_unpack(msg, 2, msg.n)))
+            else
+               send(msg[1], {n=0}) -- dropped upstream
+            end
+         end
+         return
+      end
+
+      -- batches of consecutive items (in order, if ordered: the stage
+      -- then has a single thread)
+      local items, pending, nextseq, nbatch = {}, {}, 1, 0
+      local function add(msg)
+         if msg.n > 1 then
+            counters.items:add(1)
+            table.insert(items, {n=msg.n-1, _unpack(msg, 2, msg.n)})
+            if #items == batch then
+               nbatch = nbatch + 1
+               send(nbatch, run(items))
+               items = {}
+            end
+         end
+      end
+      for msg in recv do
+         if ordered then
+            pending[msg[1]] = msg
+            while pending[nextseq] do
+               local msg = pending[nextseq]
+               pending[nextseq] = nil
+               nextseq = nextseq + 1
+               add(msg)
+            end
+         else
+            add(msg)
+         end
+      end
+      if #items > 0 then
+         nbatch = nbatch + 1
+         send(nbatch, run(items))
+      end
+   end
+
+   local status, err = pcall(loop)
+   if not status then
+      -- the previous stages fail as they send, once they got room
+      input:close()
+      while input:recv() ~= nil do
+      end
+   end
+   if running:add(-1) == 1 then -- the last thread of the stage
+      output:close()
+   end
+   running:free()
+   for _, counter in pairs(counters) do
+      counter:free()
+   end
+   if not status then
+      error(err, 0)
+   end
+end
+
+-- stages is a table of stages, each one being a table {func, threads=n,
+-- init={f1, f2, ...}, options={...}, batch=k}: func is called with the
+-- values of each item, and returns the values of the item passed to the
+-- next stage (nothing drops the item); threads (1 by default), init and
+-- options are the arguments of threads.Threads() for the pool of the
+-- stage; with batch, func is called with a table of (up to) k items, each
+-- one being a table of values. options are size (the number of items each
+-- channel holds, 16 by default) and ordered (the output comes in the order
+-- of the input, false by default)
+function Pipeline.new(stages, options)
+   assert(type(stages) == 'table' and #stages > 0, 'table of stages expected')
+   options = options or {}
+   local size = options.size or 16
+   local self = {ordered=options.ordered and true or false, stages={}, channels={},
+                 pushed=0, popped=0, pending={}, started=now()}
+   setmetatable(self, Pipeline)
+
+   self.channels[1] = Channel{size=size}
+   for s, stage in ipairs(stages) do
+      local func = stage[1]
+      local N = stage.threads or 1
+      assert(type(func) == 'function', string.format('stage %d: function expected', s))
+      assert(type(N) == 'number' and N >= 1, string.format('stage %d: positive number of threads expected', s))
+      assert(not (stage.batch and self.ordered and N > 1),
+             string.format('stage %d: an ordered batch stage runs in a single thread', s))
+      -- the output grows (until popped), so that the stages never wait
+      -- for the caller, and push() can wait for room in the input
+      self.channels[s+1] = Channel{size=size, growable=(s == #stages)}
+      local pool = Threads(N, stage.options or {}, _unpack(stage.init or {}))
+      local ids = {input=self.channels[s]:id(), output=self.channels[s+1]:id()}
+      local atomics = {running=clib.Atomic()}
+      atomics.running:set(N)
+      for _, name in ipairs(counters) do
+         atomics[name] = clib.Atomic()
+      end
+      for name, atomic in pairs(atomics) do
+         ids[name] = atomic:id()
+      end
+      pool:specific(true)
+      local futures = {}
+      for i=1,N do
+         futures[i] = pool:submit(i, runstage, func, stage.batch, self.ordered, ids)
+      end
+      self.stages[s] = {pool=pool, threads=N, atomics=atomics, futures=futures}
+   end
+   self.input = self.channels[1]
+   self.output = self.channels[#self.channels]
+   return self
+end
+
+local function pack(...)
+   return {n=select('#', ...), ...}
+end
+
+-- next output message, or nil if none came within timeout seconds (if
+-- given), or if the output is closed and empty
+local function receive(self, timeout)
+   local msg = pack(self.output:recv(timeout))
+   if msg.n > 0 then
+      return msg
+   end
+end
+
+-- waits for the stages to be done, and raises the error of the last stage
+-- which failed
+local function finish(self)
+   for _, stage in ipairs(self.stages) do
+      for _, future in ipairs(stage.futures) do
+         future:wait()
+      end
+   end
+   for s=#self.stages,1,-1 do
+      for _, future in ipairs(self.stages[s].futures) do
+         local status, err = pcall(future.get, future)
+         if not status then
+            self.error = err
+            error(err, 0)
+         end
+      end
+   end
+end
+
+-- sends an item to the first stage, waiting for room unless try is set
+-- (then returns false if there is none); a stage which fails closes its
+-- input, hence the first one (and raises its error here)
+local function send(self, try, ...)
+   local input = self.input
+   local status, sent = pcall(try and input.trysend or input.send, input, self.pushed + 1, ...)
+   if not status then
+      finish(self)
+      error('pipeline closed')
+   end
+   if sent ~= false then
+      self.pushed = self.pushed + 1
+   end
+   return sent ~= false
+end
+
+-- sends an item (the given values) to the first stage; waits for room
+-- (the output never blocks the stages, as it keeps the items until popped)
+function Pipeline:push(...)
+   assert(select('#', ...) > 0, 'at least one value expected')
+   send(self, false, ...)
+end
+
+-- like push(), but returns false instead of waiting if the first stage
+-- has no room
+function Pipeline:trypush(...)
+   assert(select('#', ...) > 0, 'at least one value expected')
+   return send(self, true, ...)
+end
+
+-- no more items: the stages finish once they processed the pushed ones
+function Pipeline:close()
+   if not self.input:isclosed() then
+      self.input:close()
+   end
+end
+
+-- returns the values of the next item out of the last stage, waiting for
+-- it at most timeout seconds (if given); returns nothing if none came, or
+-- once all the items are out (after close())
+function Pipeline:pop(timeout)
+   local deadline = timeout and now() + timeout
+   while true do
+      local msg
+      if self.ordered and self.pending[self.popped+1] then
+         msg = self.pending[self.popped+1]
+         self.pending[self.popped+1] = nil
+      else
+         msg = receive(self, deadline and math.max(deadline - now(), 0))
+         if not msg then
+            if self.output:isclosed() then
+               finish(self)
+            end
+            return
+         end
+         if self.ordered and msg[1] ~= self.popped+1 then
+            self.pending[msg[1]] = msg
+            msg = nil
+         end
+      end
+      if msg then
+         self.popped = self.popped + 1
+         if msg.n > 1 then
+            return _unpack(msg, 2, msg.n)
+         end
+      end
+   end
+end
+
+-- counters of each stage: its number of threads, the items it processed
+-- (and their rate, per second), the seconds its threads spent running func
+-- (busy), waiting for items (idle) and waiting for room in the next
+-- channel (blocked), and utilization, busy over its threads' time; the
+-- slowest stage is the one with the highest utilization, the stage to widen
+function Pipeline:stats()
+   local elapsed = now() - self.started
+   local stats = {time=elapsed, pushed=self.pushed, popped=self.popped, stages={}}
+   local slowest = 0
+   for s, stage in ipairs(self.stages) do
+      local atomics = stage.atomics
+      local busy = atomics.busy:get()/1e6
+      stats.stages[s] = {
+         threads = stage.threads,
+         items = atomics.items:get(),
+         rate = atomics.items:get()/elapsed,
+         busy = busy,
+         idle = atomics.idle:get()/1e6,
+         blocked = atomics.blocked:get()/1e6,
+         utilization = busy/(elapsed*stage.threads),
+         input = self.channels[s].queue:stats()
+      }
+      if slowest == 0 or stats.stages[s].utilization > stats.stages[slowest].utilization then
+         slowest = s
+      end
+   end
+   stats.slowest = slowest
+   return stats
+end
+
+-- closes the input, drops the items left, and terminates the pools of the
+-- stages; raises the error of a stage, unless push() or pop() did already
+function Pipeline:terminate()
+   if self.terminated then
+      return
+   end
+   local reported = self.error
+   self:close()
+   local status, err = pcall(finish, self)
+   self.pending = {}
+   for _, stage in ipairs(self.stages) do
+      stage.pool:terminate()
+      for _, atomic in pairs(stage.atomics) do
+         atomic:free()
+      end
+   end
+   self.terminated = true
+   if not status and not reported then
+      error(err, 0)
+   end
+end
+
+return Pipeline
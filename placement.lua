@@ -0,0 +1,144 @@
+-- Placement of the threads of a pool on cpus and numa nodes.
+-- The topology comes from sysfs (Linux); elsewhere, only explicit cpu
+-- lists apply.
+
+local placement = {}
+
+-- parses a sysfs list, such as "0-3,8-11"
+local function parselist(str)
+   local list = {}
+   for range in str:gmatch('[^,%s]+') do
+      local first, last = range:match('^(%d+)%-(%d+)$')
+      first = tonumber(first or range)
+      last = tonumber(last or range)
+      if first and last then
+         for i=first,last do
+            table.insert(list, i)
+         end
+      end
+   end
+   return list
+end
+
+local function readfile(path)
+   local f = io.open(path)
+   if f then
+      local str = f:read('*a')
+      f:close()
+      return str
+   end
+end
+
+-- returns {numa=boolean, nodes={{cpu, ...}, ...}, nodeids={node, ...}},
+-- or nil if the topology is unknown
+function placement.topology()
+   local topology = {numa=false, nodes={}, nodeids={}}
+   local online = readfile('/sys/devices/system/node/online')
+   if online then
+      for _, node in ipairs(parselist(online)) do
+         local cpus = readfile(string.format('/sys/devices/system/node/node%d/cpulist', node))
+         cpus = cpus and parselist(cpus) or {}
+         if #cpus > 0 then
+            table.insert(topology.nodes, cpus)
+            table.insert(topology.nodeids, node)
+         end
+      end
+      topology.numa = (#topology.nodes > 0)
+   end
+   if #topology.nodes == 0 then
+      local cpus = readfile('/sys/devices/system/cpu/online')
+      cpus = cpus and parselist(cpus) or {}
+      if #cpus == 0 then
+         return nil
+      end
+      topology.nodes[1] = cpus
+      topology.nodeids[1] = 0
+   end
+   return topology
+end
+
+local function cycle(list, i)
+   return list[(i-1) % #list + 1]
+end
+
+-- cpus of the i-th thread, according to options.affinity
+local function affinity(options, topology, i)
+   local policy = options.affinity
+   if type(policy) == 'table' then
+      local cpus = cycle(policy, i)
+      return type(cpus) == 'table' and cpus or {cpus}
+   elseif not topology then
+      return nil
+   elseif policy == 'compact' then -- fill the nodes one after the other
+      local all = {}
+      for _, cpus in ipairs(topology.nodes) do
+         for _, cpu in ipairs(cpus) do
+            table.insert(all, cpu)
+         end
+      end
+      return {cycle(all, i)}
+   elseif policy == 'scatter' then -- round-robin over the nodes
+      local nnode = #topology.nodes
+      local cpus = topology.nodes[(i-1) % nnode + 1]
+      return {cycle(cpus, math.floor((i-1) / nnode) + 1)}
+   end
+end
+
+-- index (in topology.nodes) of the node of the i-th thread, according to options.numa
+local function numanode(options, topology, i, cpus)
+   if type(options.numa) == 'table' then
+      local nodeid = cycle(options.numa, i)
+      for n, id in ipairs(topology.nodeids) do
+         if id == nodeid then
+            return n
+         end
+      end
+      error(string.format('unknown numa node %s', tostring(nodeid)))
+   elseif cpus and cpus[1] then
+      for n, nodecpus in ipairs(topology.nodes) do
+         for _, cpu in ipairs(nodecpus) do
+            if cpu == cpus[1] then
+               return n
+            end
+         end
+      end
+   else
+      return (i-1) % #topology.nodes + 1
+   end
+end
+
+-- thread attributes (see threads.Thread()) of each of the N threads of a pool,
+-- given the affinity, numa and stacksize options of threads.Threads()
+function placement.assign(N, options, topology)
+   local policy = options.affinity
+   assert(policy == nil or policy == 'compact' or policy == 'scatter' or type(policy) == 'table',
+          'affinity must be "compact", "scatter" or a table of cpus')
+   assert(options.numa == nil or type(options.numa) == 'boolean' or type(options.numa) == 'table',
+          'numa must be a boolean or a table of nodes')
+   assert(options.stacksize == nil or (type(options.stacksize) == 'number' and options.stacksize > 0),
+          'stacksize must be a positive number')
+   if (policy and type(policy) ~= 'table') or options.numa then
+      topology = topology or placement.topology()
+   end
+
+   local attrs = {}
+   for i=1,N do
+      local attr = {stacksize=options.stacksize}
+      if policy then
+         attr.cpus = affinity(options, topology, i)
+      end
+      if options.numa and topology then
+         local n = numanode(options, topology, i, attr.cpus)
+         if n then
+            attr.cpus = attr.cpus or topology.nodes[n] -- run where the memory is
+            if topology.numa then
+               attr.numanode = topology.nodeids[n]
+            end
+         end
+      end
+      attrs[i] = attr
+   end
+   return attrs
+end
+
+return placement
@@ -0,0 +1,159 @@
+-- Rings of preallocated slots (each one being one or more tensors, or tds
+-- objects), which producers fill in place and consumers borrow, instead of
+-- allocating new tensors for every batch. A slot travels, by pointer (see
+-- sharedserialize), through two channels: the free slots, and the filled
+-- ones. A ring is a table of channel ids, hence can be given to a job, in
+-- which threads.Prefetch(ring) attaches to it.
+
+local Channel = require 'threads.channel'
+local _unpack = unpack or table.unpack
+
+local Prefetch = {}
+Prefetch.__index = Prefetch
+
+setmetatable(
+   Prefetch, {
+      __call =
+         function(self, ...)
+            return Prefetch.new(...)
+         end
+   }
+)
+
+-- the channels of each ring, and the slots held in this thread
+local attached = setmetatable({}, {__mode='k'})
+
+local function newproxygc(func)
+   local proxy
+   if newproxy then -- 5.1
+      proxy = newproxy(true)
+      getmetatable(proxy).__gc = func
+   else -- 5.2
+      proxy = {}
+      setmetatable(proxy, {__gc=func})
+   end
+   return proxy
+end
+
+-- closes the ring, and drops the slots left in it (releasing their shared
+-- objects); the channels are attached anew, as the ones of the collected
+-- ring might have been finalized first, and each id holds a reference
+-- taken for this (see Prefetch.new())
+local function drain(ids)
+   for _, id in ipairs(ids) do
+      local channel = Channel.attach(id)
+      if not channel:isclosed() then
+         channel:close()
+      end
+      while channel:recv() ~= nil do
+      end
+      channel.queue:free() -- the reference taken for drain()
+   end
+end
+
+local function pack(...)
+   return {n=select('#', ...), ...}
+end
+
+-- Prefetch(ring) attaches to an existing ring (in any thread); otherwise,
+-- creates a ring of K slots, the values returned by factory(i) for slot i;
+-- the ring is closed, and its slots dropped, once collected in the thread
+-- which created it
+function Prefetch.new(K, factory)
+   if type(K) == 'table' then
+      local ring = K
+      local self = setmetatable({slots=ring.slots, freeid=ring.freeid, readyid=ring.readyid}, Prefetch)
+      attached[self] = {free=Channel.attach(ring.freeid), ready=Channel.attach(ring.readyid), held={}}
+      return self
+   end
+   assert(type(K) == 'number' and K >= 1, 'positive number of slots expected')
+   assert(type(factory) == 'function', 'slot factory expected')
+   local options = {size=K, serialize='threads.sharedserialize'}
+   local free, ready = Channel(options), Channel(options)
+   for i=1,K do
+      local slot = pack(factory(i))
+      assert(slot.n > 0, 'slot factory returned nothing')
+      free:send(i, _unpack(slot, 1, slot.n))
+   end
+   local self = setmetatable({slots=K, freeid=free:id(), readyid=ready:id()}, Prefetch)
+   local ids = {free:id(), ready:id()}
+   free.queue:retain() -- drain() will free them
+   ready.queue:retain()
+   attached[self] = {
+      free = free,
+      ready = ready,
+      held = {},
+      proxy = newproxygc(
+         function()
+            drain(ids)
+         end
+      )
+   }
+   return self
+end
+
+-- takes a slot out of channel, keeping its values for give()
+local function take(self, channel, timeout)
+   local ring = attached[self]
+   local slot = pack(ring[channel]:recv(timeout))
+   if slot.n > 0 then
+      ring.held[slot[1]] = slot
+      return _unpack(slot, 1, slot.n)
+   end
+end
+
+-- hands a slot taken in this thread over to channel (dropped if closed)
+local function give(self, channel, i)
+   local ring = attached[self]
+   local slot = ring.held[i]
+   assert(slot, string.format('slot %s is not held by this thread', tostring(i)))
+   ring.held[i] = nil
+   local status, err = pcall(ring[channel].send, ring[channel], _unpack(slot, 1, slot.n))
+   if not status and not ring[channel]:isclosed() then
+      error(err, 0)
+   end
+end
+
+-- returns the index of a free slot, and its values, to be filled in place;
+-- waits at most timeout seconds (if given); returns nothing if none came,
+-- or if the ring is closed
+function Prefetch:acquire(timeout)
+   return take(self, 'free', timeout)
+end
+
+-- hands the acquired slot i, filled, to the consumers
+function Prefetch:publish(i)
+   give(self, 'ready', i)
+end
+
+-- returns the index of the next filled slot, and its values; waits at most
+-- timeout seconds (if given); returns nothing if none came, or if the ring
+-- is closed and all the filled slots were borrowed
+function Prefetch:borrow(timeout)
+   return take(self, 'ready', timeout)
+end
+
+-- gives the borrowed slot i back to the producers
+function Prefetch:release(i)
+   give(self, 'free', i)
+end
+
+-- the producers get no more slots (the free ones are dropped here), and
+-- the consumers get the filled ones left; slots released or published
+-- afterwards are dropped too
+function Prefetch:close()
+   local ring = attached[self]
+   for _, channel in ipairs{ring.free, ring.ready} do
+      if not channel:isclosed() then
+         channel:close()
+      end
+   end
+   while ring.free:recv() ~= nil do
+   end
+end
+
+function Prefetch:isclosed()
+   return attached[self].ready:isclosed()
+end
+
+return Prefetch
@@ -1,76 +1,295 @@
 local clib = require 'libthreads'
 
+local now = clib.now
 local unpack = unpack or table.unpack
 local Queue = clib.Queue
 
+-- producer side: callbacks serialized once, per serialization package
+local saved = {}
+
+-- consumer side: callbacks loaded once, by storage address
+-- (an entry holds its storage, so the address cannot be reused while cached)
+local loaded = {}
+local nloaded = 0
+local maxloaded = 1024
+
+-- true if callback has upvalues other than _ENV (which every function has
+-- on Lua 5.2+, and which is bound to the globals of the loading thread)
+local function hasupvalues(callback)
+   local i = 1
+   while true do
+      local name = debug.getupvalue(callback, i)
+      if not name then
+         return false
+      elseif name ~= '_ENV' then
+         return true
+      end
+      i = i + 1
+   end
+end
+
+local function savecallback(serialize, name, callback, cache)
+   if not cache then
+      return serialize.save(callback)
+   end
+   local bucket = saved[name]
+   if not bucket then
+      bucket = setmetatable({}, {__mode='k'})
+      saved[name] = bucket
+   end
+   local storage = bucket[callback]
+   if not storage then
+      storage = serialize.save(callback)
+      bucket[callback] = storage
+   end
+   return storage
+end
+
+local function loadcallback(queue, serialize, storage, args)
+   if not args.__cached then
+      local callback = serialize.load(storage)
+      queue:recycle(storage)
+      return callback
+   end
+   local ptr = torch.pointer(storage)
+   local entry = loaded[ptr]
+   if not entry then
+      if nloaded >= maxloaded then
+         loaded = {}
+         nloaded = 0
+      end
+      entry = {storage, serialize.load(storage)}
+      loaded[ptr] = entry
+      nloaded = nloaded + 1
+   end
+   return entry[2]
+end
+
+-- flat arguments (numbers, strings, booleans, and tensors when they are
+-- shared) have a compact native encoding, into a recycled buffer; anything
+-- else is serialized; returns true once pushed, nil if the queue is closed;
+-- with try, returns false instead of waiting for room
+local function pushjob(queue, serialize, callback, args, try)
+   local share = queue.serialize == 'threads.sharedserialize'
+   local flat, pushed
+   if try then
+      flat, pushed = queue:trypushargs(callback, args, share)
+   else
+      flat, pushed = queue:pushargs(callback, args, share)
+   end
+   if not flat then
+      local storage = serialize.save(args)
+      if try then
+         pushed = queue:trypush(callback, storage)
+      else
+         pushed = queue:push(callback, storage)
+      end
+      if not pushed and share then
+         serialize.load(storage) -- releases the shared objects
+      end
+   end
+   return pushed
+end
+
+-- popped arguments are already decoded if they had the native encoding
+local function loadargs(queue, serialize, args)
+   if type(args) == 'table' then
+      return args
+   end
+   local storage = args
+   args = serialize.load(storage)
+   queue:recycle(storage)
+   return args
+end
+
+-- runs a job; run(callback, args, popped), if given, replaces callback(unpack(args)),
+-- popped being the time (see threads.now()) at which the job was taken from the queue
+local function runjob(queue, serialize, callback, args, run)
+   local popped = run and now()
+   args = loadargs(queue, serialize, args)
+   callback = loadcallback(queue, serialize, callback, args)
+   if run then
+      return {run(callback, args, popped)}
+   else
+      return {callback(unpack(args, 1, args.n or #args))} -- note: args is a table for sure
+   end
+end
+
+-- returns true once the job is queued, nil if the queue is closed
 function Queue:addjob(callback, ...)
-   local args = {...}
+   return self:addjobpacked(callback, {...})
+end
+
+-- like addjob(), but returns false (instead of waiting) if the queue is full
+function Queue:tryaddjob(callback, ...)
+   return self:tryaddjobpacked(callback, {...})
+end
+
+local function addjobpacked(self, callback, args, cache, try)
    local status, msg = pcall(
       function()
-         self.mutex:lock()
-         while self.isfull == 1 do
-            self.notfull:wait(self.mutex)
-         end
-
          local serialize = require(self.serialize)
-
-         self:callback(self.tail, serialize.save(callback))
-         self:arg(self.tail, serialize.save(args))
-
-         self.tail = self.tail + 1
-         if self.tail == self.size then
-            self.tail = 0
+         if cache and hasupvalues(callback) then
+            cache = false -- the upvalues might have changed since it was first sent
          end
-         if self.tail == self.head then
-            self.isfull = 1
+         if cache then
+            args.__cached = true
          end
-         self.isempty = 0
-
-         self.mutex:unlock()
-         self.notempty:signal()
+         local storage = savecallback(serialize, self.serialize, callback, cache)
+         local pushed = pushjob(self, serialize, storage, args, try)
+         if not pushed and not cache and self.serialize == 'threads.sharedserialize' then
+            serialize.load(storage) -- releases the shared upvalues
+         end
+         return pushed
       end
    )
    if not status then
       print(string.format('FATAL THREAD PANIC: (addjob) %s', msg))
       os.exit(-1)
    end
+   return msg
 end
 
-function Queue:dojob()
+-- args is a table of arguments (args.n, if present, being their number)
+-- if cache is true, the callback is serialized only once (by identity),
+-- and loaded only once by each consumer; returns true once the job is
+-- queued, nil if the queue is closed
+function Queue:addjobpacked(callback, args, cache)
+   return addjobpacked(self, callback, args, cache)
+end
+
+-- like addjobpacked(), but returns false (instead of waiting) if the queue
+-- is full, true if the job was queued, nil if the queue is closed
+function Queue:tryaddjobpacked(callback, args, cache)
+   return addjobpacked(self, callback, args, cache, true)
+end
+
+-- returns nothing if no job came within timeout seconds (if given),
+-- or if the queue is closed and empty
+function Queue:dojob(timeout, run)
    local status, msg = pcall(
       function()
          local serialize = require(self.serialize)
-
-         self.mutex:lock()
-         while self.isempty == 1 do
-            self.notempty:wait(self.mutex)
+         local callback, args = self:pop(timeout)
+         if not callback then
+            return {}
          end
+         return runjob(self, serialize, callback, args, run)
+      end
+   )
+   if not status then
+      print(string.format('FATAL THREAD PANIC: (dojob) %s', msg))
+      os.exit(-1)
+   end
+   return unpack(msg)
+end
 
+-- executed on the consumer side: runs every job of a batch in order
+-- (serialized with the batch, hence no upvalues)
+local function runbatch(jobs)
+   local unpack = _G.unpack or table.unpack
+   local res = {}
+   for i=1,#jobs do
+      local job = jobs[i]
+      local n = 0
+      for k in pairs(job) do
+         if type(k) == 'number' and k > n then
+            n = k
+         end
+      end
+      res[i] = {job[1](unpack(job, 2, n))}
+   end
+   return res
+end
 
-         local callback = serialize.load(self:callback(self.head))
-         local args = serialize.load(self:arg(self.head))
+function Queue:addjobs(jobs)
+   assert(type(jobs) == 'table', 'table of jobs expected')
+   for i=1,#jobs do
+      assert(type(jobs[i]) == 'table' and type(jobs[i][1]) == 'function',
+             'each job must be a table {callback, [...]}')
+   end
+   self:addjob(runbatch, jobs)
+end
 
-         self.head = self.head + 1
-         if self.head == self.size then
-            self.head = 0
+function Queue:dojobs(max, run)
+   local status, msg = pcall(
+      function()
+         local serialize = require(self.serialize)
+         local callbacks, args = self:popmany(max)
+         local res = {}
+         for i=1,#callbacks do
+            res[i] = runjob(self, serialize, callbacks[i], args[i], run)
          end
-         if self.head == self.tail then
-            self.isempty = 1
+         return res
+      end
+   )
+   if not status then
+      print(string.format('FATAL THREAD PANIC: (dojobs) %s', msg))
+      os.exit(-1)
+   end
+   return msg
+end
+
+-- runs the next job found in any of the given queues, looking at
+-- queues[start] first; waits (at most timeout seconds, if given) if they
+-- are all empty
+function Queue.dojobany(queues, start, timeout, run)
+   local status, msg = pcall(
+      function()
+         local idx, callback, args = Queue.select(queues, start, timeout)
+         if not idx then
+            return {}
          end
-         self.isfull = 0
+         local serialize = require(queues[idx].serialize)
+         return runjob(queues[idx], serialize, callback, args, run)
+      end
+   )
+   if not status then
+      print(string.format('FATAL THREAD PANIC: (dojobany) %s', msg))
+      os.exit(-1)
+   end
+   return unpack(msg)
+end
 
-         self.mutex:unlock()
-         self.notfull:signal()
+-- like Queue.dojobany(), but returns the index of the queue of the job
+-- before its results (nothing if no job came)
+function Queue.selectjob(queues, start, timeout, run)
+   local status, msg = pcall(
+      function()
+         local idx, callback, args = Queue.select(queues, start, timeout)
+         if not idx then
+            return {}
+         end
+         local serialize = require(queues[idx].serialize)
+         local res = runjob(queues[idx], serialize, callback, args, run)
+         return {n=#res+1, idx, unpack(res)}
+      end
+   )
+   if not status then
+      print(string.format('FATAL THREAD PANIC: (selectjob) %s', msg))
+      os.exit(-1)
+   end
+   return unpack(msg, 1, msg.n)
+end
 
-         local res = {callback(unpack(args))} -- note: args is a table for sure
+-- like Queue:dojobs(), over several queues
+function Queue.dojobsany(queues, max, start, run)
+   local status, msg = pcall(
+      function()
+         local indices, callbacks, args = Queue.selectmany(queues, max, start)
+         local res = {}
+         for i=1,#callbacks do
+            local serialize = require(queues[indices[i]].serialize)
+            res[i] = runjob(queues[indices[i]], serialize, callbacks[i], args[i], run)
+         end
          return res
       end
    )
    if not status then
-      print(string.format('FATAL THREAD PANIC: (dojob) %s', msg))
+      print(string.format('FATAL THREAD PANIC: (dojobsany) %s', msg))
       os.exit(-1)
    end
-   return unpack(msg)
+   return msg
 end
 
 return Queue
@@ -29,36 +29,105 @@ local function newproxygc(func)
    return proxy
 end
 
-return function(func, mutex)
+-- the hash of a key (a number, string or boolean), the same in all threads
+local function keyhash(key)
+   local t = type(key)
+   if t == 'number' then
+      return math.floor(key)
+   elseif t == 'string' then
+      -- like lua, hashes (at most) 32 characters of long strings
+      local h = #key
+      local step = math.floor(#key/32) + 1
+      for i=#key,1,-step do
+         h = (h*31 + key:byte(i)) % 4294967296
+      end
+      return h
+   elseif t == 'boolean' then
+      return key and 1 or 0
+   end
+   error('number, string or boolean key expected for a striped lock')
+end
+
+return function(func, lock, mode)
    local threads = require 'threads'
 
-   assert(type(func) == 'function', 'function, [mutex] expected')
-   assert(mutex == nil or getmetatable(threads.Mutex).__index == getmetatable(mutex).__index, 'function, [mutex] expected')
+   local function kind(lock)
+      local mt = getmetatable(lock)
+      if mt and mt.__index == getmetatable(threads.Mutex).__index then
+         return 'mutex'
+      elseif mt and mt.__index == getmetatable(threads.RWLock).__index then
+         return 'rwlock'
+      end
+   end
+
+   mode = mode or 'exclusive'
+   assert(type(func) == 'function', 'function, [lock], [mode] expected')
+   assert(mode == 'exclusive' or mode == 'shared', 'exclusive or shared mode expected')
 
-   -- make sure mutex is freed if it is our own
+   -- a lock, or a table of locks (of the same kind) picked by the hash of
+   -- the first argument of func
+   local lockkind, lockids, striped
+   if type(lock) == 'table' then
+      assert(#lock > 0, 'function, [lock], [mode] expected')
+      lockkind = kind(lock[1])
+      lockids = {}
+      for i, l in ipairs(lock) do
+         assert(kind(l) and kind(l) == lockkind, 'function, [lock], [mode] expected')
+         lockids[i] = l:id()
+      end
+      striped = true
+   else
+      assert(lock == nil or kind(lock), 'function, [lock], [mode] expected')
+   end
+
+   -- make sure lock is freed if it is our own
    local proxy
-   if not mutex then
-      mutex = threads.Mutex()
+   if not lock then
+      if mode == 'shared' then
+         lock = threads.RWLock()
+      else
+         lock = threads.Mutex()
+      end
       proxy = newproxygc(
          function()
-            mutex:free()
+            lock:free()
          end
       )
    end
+   if not striped then
+      lockkind = kind(lock)
+      lockids = {lock:id()}
+   end
+   assert(mode == 'exclusive' or lockkind == 'rwlock', 'shared mode needs a threads.RWLock')
 
-   local mutexid = mutex:id()
+   local shared = (mode == 'shared')
    local safe =
       function(...)
          local threads = require 'threads'
-         local mutex = threads.Mutex(mutexid)
          local unpack = unpack or table.unpack
-         mutex:lock()
+         local id = lockids[1]
+         if striped then
+            id = lockids[keyhash((...)) % #lockids + 1]
+         end
+         local lock
+         if lockkind == 'mutex' then
+            lock = threads.Mutex(id)
+            lock:lock()
+         else
+            lock = threads.RWLock(id)
+            if shared then
+               lock:rdlock()
+            else
+               lock:wrlock()
+            end
+         end
          local res = {func(...)}
-         mutex:unlock()
+         lock:unlock()
+         lock:free()
          return unpack(res)
       end
 
-   -- make sure mutex is freed if it is our own
+   -- make sure lock is freed if it is our own
    if proxy then
       setfenv(safe, {require=require, unpack=unpack, table=table, proxy=proxy})
    end
@@ -0,0 +1,34 @@
+local threads = require 'threads'
+require 'torch'
+
+-- threads adding their updates to a shared tensor at once
+local N, M = 4, 50
+local weights = torch.zeros(10, 7) -- 70 elements, in stripes of 5
+local acc = threads.Accumulator(weights, 14)
+assert(acc:tensor() == weights)
+
+local pool = threads.Threads(N, function() require 'torch' end)
+for i=1,N do
+   pool:addjob(function(acc, i, M)
+                  local acc = require('threads').Accumulator(acc)
+                  local grad = torch.Tensor(10, 7):fill(i)
+                  for j=1,M do
+                     acc:add(grad, 0.5)
+                  end
+               end,
+               nil,
+               acc, i, M)
+end
+pool:synchronize()
+local expected = M*0.5*N*(N+1)/2
+assert(weights:min() == expected and weights:max() == expected, 'lost updates')
+
+-- non-contiguous updates, and reading the tensor stripe by stripe
+acc:add(torch.ones(7, 10):t(), -expected)
+local sum = 0
+acc:apply(function(stripe) sum = sum + stripe:sum() end)
+assert(sum == 0)
+assert(not pcall(acc.add, acc, torch.ones(3)), 'size mismatch expected')
+pool:terminate()
+
+print('PASSED')
@@ -0,0 +1,76 @@
+local threads = require 'threads'
+local placement = require 'threads.placement'
+
+local function cpus(attrs)
+   local res = {}
+   for i, attr in ipairs(attrs) do
+      res[i] = table.concat(attr.cpus or {}, ',')
+   end
+   return table.concat(res, ' ')
+end
+
+local function nodes(attrs)
+   local res = {}
+   for i, attr in ipairs(attrs) do
+      res[i] = tostring(attr.numanode)
+   end
+   return table.concat(res, ' ')
+end
+
+-- placement policies, on a two-socket machine
+local topology = {numa=true, nodes={{0,1,2,3}, {4,5,6,7}}, nodeids={0,1}}
+
+assert(cpus(placement.assign(3, {}, topology)) == '  ')
+assert(cpus(placement.assign(5, {affinity='compact'}, topology)) == '0 1 2 3 4')
+assert(cpus(placement.assign(5, {affinity='scatter'}, topology)) == '0 4 1 5 2')
+assert(cpus(placement.assign(3, {affinity={{0,1}, {2,3}}}, topology)) == '0,1 2,3 0,1')
+assert(cpus(placement.assign(3, {affinity={6, 2}}, topology)) == '6 2 6')
+
+local attrs = placement.assign(3, {numa=true}, topology)
+assert(cpus(attrs) == '0,1,2,3 4,5,6,7 0,1,2,3')
+assert(nodes(attrs) == '0 1 0')
+
+attrs = placement.assign(2, {affinity='scatter', numa=true}, topology)
+assert(cpus(attrs) == '0 4')
+assert(nodes(attrs) == '0 1')
+
+attrs = placement.assign(2, {numa={1}}, topology)
+assert(cpus(attrs) == '4,5,6,7 4,5,6,7')
+assert(nodes(attrs) == '1 1')
+
+assert(not pcall(placement.assign, 2, {numa={3}}, topology), 'unknown node should fail')
+assert(not pcall(placement.assign, 2, {affinity='everywhere'}, topology), 'unknown policy should fail')
+assert(placement.assign(1, {stacksize=2^20})[1].stacksize == 2^20)
+print('placement ok')
+
+-- a pool pinned to the first cpu, with a given stack size
+local pool = threads.Threads(2, {affinity={0}, stacksize=4*2^20})
+for i=1,2 do
+   pool:addjob(
+      function()
+         local f = io.open('/proc/thread-self/status')
+         if f then
+            local status = f:read('*a')
+            f:close()
+            return status:match('Cpus_allowed_list:%s*(%S+)')
+         end
+      end,
+      function(allowed)
+         assert(allowed == nil or allowed == '0', 'thread not pinned')
+      end
+   )
+end
+pool:synchronize()
+pool:terminate()
+
+-- the machine topology, whatever it is
+pool = threads.Threads(2, {affinity='compact', numa=true})
+local sum = 0
+for i=1,10 do
+   pool:addjob(function() return i end, function(x) sum = sum + x end)
+end
+pool:synchronize()
+pool:terminate()
+assert(sum == 55)
+
+print('PASSED')
@@ -0,0 +1,53 @@
+local threads = require 'threads'
+local Queue = require 'threads.queue'
+require 'torch'
+
+-- flat tables have a compact encoding
+local args = {n=6, 1, -2.5, 'a\0b', true, false, nil, name='x', [10]=3}
+local storage = Queue.packargs(args)
+assert(storage)
+local res = Queue.unpackargs(storage)
+for k, v in pairs(args) do
+   assert(res[k] == v)
+end
+for k, v in pairs(res) do
+   assert(args[k] == v)
+end
+
+-- anything else is left to the serializer
+assert(Queue.packargs({1, {2}}) == nil)
+assert(Queue.packargs({[true]=1}) == nil)
+assert(Queue.packargs({function() end}) == nil)
+assert(Queue.unpackargs(require('threads.serialize').save({1, 2})) == nil)
+
+-- arguments and results go both ways, nils included
+local pool = threads.Threads(2)
+local ndone = 0
+pool:addjob(
+   function(a, b, c, d, e)
+      assert(a == 1 and b == nil and c == 'c' and d == true and e == nil)
+      return nil, 2, nil
+   end,
+   function(...)
+      assert(select('#', ...) == 3)
+      local x, y, z = ...
+      assert(x == nil and y == 2 and z == nil)
+      ndone = ndone + 1
+   end,
+   1, nil, 'c', true, nil
+)
+pool:addjob(
+   function(t)
+      return {t[1]+1}
+   end,
+   function(t)
+      assert(t[1] == 2)
+      ndone = ndone + 1
+   end,
+   {1}
+)
+pool:synchronize()
+assert(ndone == 2)
+pool:terminate()
+
+print('PASSED')
@@ -0,0 +1,55 @@
+local threads = require 'threads'
+
+-- integers
+local a = threads.Atomic()
+assert(not a:isdouble() and a:get() == 0)
+a:set(5)
+assert(a:add() == 5 and a:add(10) == 6 and a:sub(4) == 16 and a:load() == 12)
+a:store(2^40) -- 64 bits, whatever the size of long
+assert(a:add(1) == 2^40 and a:get() == 2^40+1)
+assert(a:exchange(7) == 2^40+1 and a:get() == 7)
+local swapped, old = a:cas(3, 4)
+assert(not swapped and old == 7 and a:get() == 7)
+swapped, old = a:cas(7, 8)
+assert(swapped and old == 7 and a:get() == 8)
+a:free()
+
+-- doubles
+local d = threads.Atomic{double=true, value=0.5}
+assert(d:isdouble() and d:get() == 0.5)
+assert(d:add(0.25) == 0.5 and d:sub(1) == 0.75 and d:get() == -0.25)
+assert(d:exchange(1.5) == -0.25)
+swapped, old = d:cas(1, 2)
+assert(not swapped and old == 1.5)
+swapped = d:cas(old, 2.5)
+assert(swapped and d:get() == 2.5)
+d:free()
+print('atomic ok')
+
+-- shared by id between threads
+local N, M = 4, 1000
+local count = threads.Atomic()
+local sum = threads.Atomic{double=true}
+local pool = threads.Threads(N)
+for i=1,N do
+   pool:addjob(function(countid, sumid, M)
+                  local threads = require 'threads'
+                  local count, sum = threads.Atomic(countid), threads.Atomic(sumid)
+                  for j=1,M do
+                     count:add()
+                     sum:add(0.5)
+                  end
+                  count:free()
+                  sum:free()
+               end,
+               nil,
+               count:id(), sum:id(), M)
+end
+pool:synchronize()
+pool:terminate()
+assert(count:get() == N*M, 'lost updates')
+assert(sum:get() == N*M*0.5, 'lost double updates')
+count:free()
+sum:free()
+
+print('PASSED')
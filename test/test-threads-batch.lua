@@ -0,0 +1,71 @@
+local threads = require 'threads'
+
+local nthread = 4
+local nbatch = 10
+local batchsize = 16
+
+local pool = threads.Threads(nthread)
+
+-- batched submission: one queue entry per batch
+local sum = 0
+local ndone = 0
+for b=1,nbatch do
+   local jobs = {}
+   for i=1,batchsize do
+      table.insert(jobs, {
+         function(x, y)
+            return x + y, __threadid
+         end,
+         function(z, id)
+            assert(id >= 1 and id <= nthread)
+            sum = sum + z
+            ndone = ndone + 1
+         end,
+         b, i
+      })
+   end
+   pool:addjobs(jobs)
+end
+
+-- jobs with no endcallback and nil arguments are fine too
+pool:addjobs{
+   {function(a, b, c) assert(a == nil and b == 2 and c == nil) end, nil, nil, 2, nil}
+}
+
+pool:synchronize()
+assert(ndone == nbatch*batchsize)
+assert(sum == batchsize*nbatch*(nbatch+1)/2 + nbatch*batchsize*(batchsize+1)/2)
+
+-- batched retrieval
+for i=1,8 do
+   pool:addjob(function() return i end, function(x) ndone = ndone + x end)
+end
+local n = 0
+while pool:hasjob() do
+   n = n + pool:dojobs(3)
+end
+assert(n == 8)
+assert(ndone == nbatch*batchsize + 36)
+
+-- errors are reported per job
+pool:addjobs{
+   {function() return 1 end},
+   {function() error('batch failure') end},
+}
+local ok, msg = pcall(function() pool:synchronize() end)
+assert(not ok and msg:find('batch failure'))
+pool:synchronize()
+
+-- raw queues
+local Queue = require 'threads.queue'
+local q = Queue(4, 'threads.serialize')
+q:addjobs{{function(x) return x * 2 end, 21}, {function() return 'a', 'b' end}}
+q:addjob(function() return 3 end)
+local res = q:dojob()
+assert(#res == 2 and res[1][1] == 42 and res[2][2] == 'b')
+res = q:dojobs(10)
+assert(#res == 1 and res[1][1] == 3)
+
+pool:terminate()
+
+print('PASSED')
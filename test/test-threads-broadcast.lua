@@ -0,0 +1,108 @@
+local threads = require 'threads'
+
+local function spin(seconds)
+   local now = require('threads').now
+   local t = now()
+   while now() - t < seconds do
+   end
+end
+
+-- every thread runs a broadcast exactly once, between its jobs, while the
+-- others are still queued
+local N = 3
+local pool = threads.Threads(N, function() version = 0 end)
+pool:specific(false)
+local versions = {}
+local function job(spin, i)
+   spin(0.001)
+   return i, version
+end
+local function record(i, v)
+   versions[i] = v
+end
+for i=1,30 do
+   pool:addjob(job, record, spin, i)
+end
+local ran = {}
+pool:broadcast(function(v)
+                  version = v
+                  return __threadid
+               end,
+               function(id)
+                  ran[id] = (ran[id] or 0) + 1
+               end,
+               1)
+assert(pool:hasjob())
+for i=31,60 do
+   pool:addjob(job, record, spin, i)
+end
+pool:synchronize()
+for i=1,N do
+   assert(ran[i] == 1, 'broadcast should run once in each thread')
+end
+assert(#versions == 60)
+-- (a thread might take one job queued right after the broadcast, as it
+-- looks at its own queue just before)
+for i=41,60 do
+   assert(versions[i] == 1, 'jobs after the broadcast should see it')
+end
+assert(not pool:specific(), 'the mode should not change')
+print('broadcast ok')
+
+-- a barrier: each thread (once, by broadcast) goes through rounds in step
+local barrier = threads.Barrier{count=N}
+assert(barrier:count() == N)
+local rounds = 5
+local counter = threads.Atomic()
+local last = threads.Atomic()
+pool:broadcast(function(barrierid, counterid, lastid, rounds, N)
+                  local threads = require 'threads'
+                  local barrier = threads.Barrier(barrierid)
+                  local counter, last = threads.Atomic(counterid), threads.Atomic(lastid)
+                  local ok = true
+                  for r=1,rounds do
+                     counter:add()
+                     if barrier:wait() then
+                        last:add()
+                     end
+                     -- all the threads are done with round r
+                     ok = ok and counter:get() >= r*N
+                     barrier:wait()
+                  end
+                  barrier:free()
+                  counter:free()
+                  last:free()
+                  return ok
+               end,
+               function(ok)
+                  assert(ok, 'a thread went through the barrier too early')
+               end,
+               barrier:id(), counter:id(), last:id(), rounds, N)
+pool:synchronize()
+assert(counter:get() == rounds*N)
+assert(last:get() == rounds, 'one thread per round should be the last')
+barrier:free()
+counter:free()
+last:free()
+assert(not pcall(threads.Barrier, {count=0}), 'positive count expected')
+print('barrier ok')
+
+-- in specific mode, and with priorities or stealing
+pool:specific(true)
+ran = {}
+pool:broadcast(function() return __threadid end, function(id) ran[id] = true end)
+pool:synchronize()
+assert(ran[1] and ran[2] and ran[3])
+pool:terminate()
+
+for _, options in ipairs{{priorities=2}, {stealing=true}} do
+   pool = threads.Threads(2, options)
+   pool:specific(false)
+   ran = {}
+   pool:broadcast(function() return __threadid end, function(id) ran[id] = true end)
+   pool:synchronize()
+   assert(ran[1] and ran[2])
+   pool:terminate()
+end
+
+print('PASSED')
@@ -0,0 +1,95 @@
+local threads = require 'threads'
+
+local nthread = 4
+local njob = 100
+
+local pool = threads.Threads(nthread, {cache=true})
+
+-- the same callbacks, over and over
+local function add(x, y)
+   return x + y
+end
+
+local function mul(x, y)
+   return x * y
+end
+
+local sum, prod = 0, 0
+for i=1,njob do
+   pool:addjob(add, function(z) sum = sum + z end, i, 1)
+   pool:addjob(mul, function(z) prod = prod + z end, i, 2)
+end
+pool:synchronize()
+assert(sum == njob*(njob+1)/2 + njob)
+assert(prod == njob*(njob+1))
+
+-- nil arguments are kept
+pool:addjob(
+   function(a, b, c)
+      assert(a == nil and b == 2 and c == nil)
+      return select('#', a, b, c)
+   end,
+   function(n)
+      assert(n == 3)
+   end,
+   nil, 2, nil
+)
+
+-- a callback with upvalues is not cached: it sees their changes
+local x = 1
+local function getx()
+   return x
+end
+pool:addjob(getx, function(v) assert(v == 1) end)
+pool:synchronize()
+x = 2
+pool:addjob(getx, function(v) assert(v == 2) end)
+pool:synchronize()
+
+-- errors are still reported
+local ok = pcall(
+   function()
+      pool:addjob(function() error('oops') end)
+      pool:synchronize()
+   end
+)
+assert(not ok)
+pool:synchronize()
+
+pool:terminate()
+
+-- with another serializer too, callbacks are cached unless they have
+-- upvalues (other than _ENV, which every function has on Lua 5.2+)
+threads.Threads.serialization('threads.sharedserialize')
+pool = threads.Threads(nthread, {cache=true})
+threads.Threads.serialization('threads.serialize')
+
+-- counts the copies of the callback loaded in each thread (at most one
+-- when cached); uses globals, so has _ENV as upvalue on Lua 5.2+
+local function loads()
+   __cacheseen = __cacheseen or {}
+   local self = debug.getinfo(1, 'f').func
+   if __cacheseen[self] then
+      return 0
+   end
+   __cacheseen[self] = true
+   return 1
+end
+local nload = 0
+for i=1,njob do
+   pool:addjob(loads, function(n) nload = nload + n end)
+end
+pool:synchronize()
+assert(nload <= nthread, 'callback without upvalues was not cached')
+
+-- a callback with upvalues is serialized again each time
+x = 1
+pool:addjob(getx, function(v) assert(v == 1) end)
+pool:synchronize()
+x = 2
+pool:addjob(getx, function(v) assert(v == 2) end)
+pool:synchronize()
+
+pool:terminate()
+
+print('PASSED')
@@ -0,0 +1,97 @@
+local threads = require 'threads'
+local Queue = require 'threads.queue'
+
+-- keeps the thread of a single thread pool busy, until the returned
+-- semaphore is posted
+local function block(pool)
+   local started = threads.Semaphore()
+   local release = threads.Semaphore()
+   pool:addjob(
+      function(startedid, releaseid)
+         local threads = require 'threads'
+         local started = threads.Semaphore(startedid)
+         local release = threads.Semaphore(releaseid)
+         started:post()
+         release:wait()
+         started:free()
+         release:free()
+      end,
+      nil,
+      started:id(), release:id())
+   started:wait()
+   started:free()
+   return release
+end
+
+-- a growable queue doubles instead of being full, and keeps the order
+local q = Queue(2, 'threads.serialize', {growable=true})
+for i=1,100 do
+   assert(q.isfull == 0)
+   q:addjob(function(i) return i end, i)
+end
+assert(q.size >= 100, 'queue did not grow')
+assert(q:stats().depth == 100)
+for i=1,100 do
+   assert(q:dojob() == i)
+end
+assert(q.isempty == 1)
+-- the recycled buffers grew with it: another round allocates none
+local nallocated = q:stats().nallocated
+for i=1,100 do
+   q:addjob(function(i) return i end, i)
+end
+for i=1,100 do
+   assert(q:dojob() == i)
+end
+assert(q:stats().nallocated == nallocated, 'buffers not recycled')
+print('growable queue ok')
+
+-- capacity independent of the number of threads; tryaddjob() does not wait
+local pool = threads.Threads(1, {queuesize=4})
+local count = 0
+local release = block(pool)
+for i=1,4 do
+   assert(pool:tryaddjob(function() end, function() count = count + 1 end), 'room expected')
+end
+assert(not pool:tryaddjob(function() end, function() count = count + 1 end), 'full queue expected')
+assert(not pool:acceptsjob())
+assert(count == 0)
+release:post()
+release:free()
+pool:synchronize()
+assert(count == 4)
+assert(pool:tryaddjob(function() end, function() count = count + 1 end))
+pool:synchronize()
+assert(count == 5)
+pool:terminate()
+print('queue size ok')
+
+-- growable queues: addjob() never waits for the threads
+pool = threads.Threads(1, {growable=true})
+count = 0
+release = block(pool)
+for i=1,100 do
+   pool:addjob(function(i) return i end, function(i) count = count + i end, i)
+end
+assert(count == 0, 'addjob should not have run endcallbacks')
+assert(pool:acceptsjob())
+release:post()
+release:free()
+pool:synchronize()
+assert(count == 5050)
+
+-- in specific mode too
+pool:specific(true)
+release = threads.Semaphore()
+count = 0
+pool:addjob(1, function(id) require('threads').Semaphore(id):wait() end, nil, release:id())
+for i=1,50 do
+   assert(pool:tryaddjob(1, function() end, function() count = count + 1 end))
+end
+release:post()
+pool:synchronize()
+release:free()
+assert(count == 50)
+pool:terminate()
+
+print('PASSED')
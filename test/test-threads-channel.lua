@@ -0,0 +1,148 @@
+local threads = require 'threads'
+
+-- messages are any values, received in order
+local ch = threads.Channel{size=4}
+ch:send(1, 'two', nil, {x=3})
+ch:send(true)
+local a, b, c, d = ch:recv()
+assert(a == 1 and b == 'two' and c == nil and d.x == 3)
+assert(ch:recv() == true)
+assert(ch:tryrecv() == nil)
+assert(ch:recv(0.05) == nil)
+
+-- trysend does not wait
+for i=1,4 do
+   assert(ch:trysend(i), 'room expected')
+end
+assert(not ch:trysend(5), 'full channel expected')
+for i=1,4 do
+   assert(ch:tryrecv() == i)
+end
+
+-- closed channels drain, then do not wait
+ch:send('last')
+ch:close()
+assert(ch:isclosed())
+assert(not pcall(ch.send, ch, 'more'), 'send on a closed channel should fail')
+assert(ch:recv() == 'last')
+assert(ch:recv() == nil)
+print('channel ok')
+
+-- from a queue thread to another one, without the main thread
+local N = 100
+local pool = threads.Threads(2)
+pool:specific(true)
+local numbers = threads.Channel{size=8}
+pool:addjob(1,
+            function(id, n)
+               local numbers = require('threads').Channel.attach(id)
+               for i=1,n do
+                  numbers:send(i)
+               end
+               numbers:close()
+            end,
+            nil,
+            numbers:id(), N)
+local sum
+pool:addjob(2,
+            function(id)
+               local numbers = require('threads').Channel.attach(id)
+               local sum = 0
+               for x in function() return numbers:recv() end do
+                  sum = sum + x
+               end
+               return sum
+            end,
+            function(s)
+               sum = s
+            end,
+            numbers:id())
+pool:synchronize()
+assert(sum == N*(N+1)/2, 'wrong sum')
+print('worker to worker ok')
+
+-- closing wakes up a sender waiting for room, whose send fails
+local full = threads.Channel{size=2}
+full:send('first')
+full:send('second')
+local failed
+pool:addjob(1,
+            function(id)
+               local full = require('threads').Channel.attach(id)
+               return (pcall(full.send, full, 'third'))
+            end,
+            function(ok)
+               failed = not ok
+            end,
+            full:id())
+local t = threads.now() -- leaves time to the thread to wait for room
+while threads.now() - t < 0.05 do
+end
+full:close()
+pool:synchronize()
+assert(failed, 'send on a channel closed while waiting should fail')
+assert(full:recv() == 'first' and full:recv() == 'second')
+assert(full:recv() == nil)
+assert(not pcall(full.trysend, full, 'more'), 'trysend on a closed channel should fail')
+
+-- a number is not a channel id
+assert(not pcall(threads.Channel, 10), 'options table expected')
+
+-- typed channels check the values of their messages
+local typed = threads.Channel{size=2, types={'number', 'string', '*'}}
+assert(#typed:types() == 3)
+typed:send(1, 'one', {})
+assert(not pcall(typed.send, typed, 'one', 1, {}), 'wrong types should fail')
+assert(not pcall(typed.send, typed, 1, 'one'), 'missing value should fail')
+pool:addjob(1,
+            function(id)
+               local typed = require('threads').Channel.attach(id)
+               local ok = pcall(typed.send, typed, 2, 2, 2) -- checked in any thread
+               typed:send(2, 'two', false)
+               return ok
+            end,
+            function(ok)
+               assert(not ok, 'wrong types should fail in other threads')
+            end,
+            typed:id())
+pool:synchronize()
+assert(typed:recv() == 1)
+local n, name = typed:recv()
+assert(n == 2 and name == 'two')
+print('close and types ok')
+
+-- select: waits on several channels
+local ch1, ch2 = threads.Channel(), threads.Channel()
+assert(threads.select({ch1, ch2}, 0.05) == nil)
+ch2:send('b', 2)
+local idx, x, y = threads.select{ch1, ch2}
+assert(idx == 2 and x == 'b' and y == 2)
+
+pool:addjob(1,
+            function(id)
+               require('threads').Channel.attach(id):send('a')
+            end,
+            nil,
+            ch1:id())
+idx, x = threads.select{ch1, ch2}
+assert(idx == 1 and x == 'a')
+pool:synchronize()
+
+-- every channel gets its turn
+for i=1,2 do
+   ch1:send(1)
+   ch2:send(2)
+end
+local seen = {}
+for i=1,4 do
+   local idx = threads.select{ch1, ch2}
+   seen[idx] = (seen[idx] or 0) + 1
+end
+assert(seen[1] == 2 and seen[2] == 2)
+
+ch1:close()
+ch2:close()
+assert(threads.select{ch1, ch2} == nil)
+pool:terminate()
+
+print('PASSED')
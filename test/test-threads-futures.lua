@@ -0,0 +1,72 @@
+local threads = require 'threads'
+
+local function spin(seconds)
+   local now = require('threads').now
+   local t = now()
+   while now() - t < seconds do
+   end
+end
+
+local N = 4
+local pool = threads.Threads(N)
+
+-- results
+local futures = {}
+for i=1,20 do
+   futures[i] = pool:submit(function(x, y) return x*y, 'job' .. x end, i, 2)
+end
+for i=20,1,-1 do
+   local x, name = futures[i]:get()
+   assert(x == 2*i and name == 'job' .. i)
+   assert(futures[i]:ready())
+end
+assert(not pool:hasjob())
+
+-- waiting on one job only
+local ndone = 0
+pool:addjob(function() spin(0.3) end, function() ndone = ndone + 1 end)
+local future = pool:submit(function() return 42 end)
+assert(future:get() == 42)
+assert(ndone == 0 and pool:hasjob(), 'waited for another job')
+pool:synchronize()
+assert(ndone == 1)
+
+-- timeouts
+future = pool:submit(function() spin(0.2) return true end)
+assert(not future:ready())
+assert(future:wait(0.01) == false)
+assert(future:wait() == true and future:get() == true)
+
+-- errors are raised by get(), not by the pool
+future = pool:submit(function() error('bad job') end)
+assert(future:wait())
+local status, msg = pcall(future.get, future)
+assert(not status and msg:match('bad job'))
+pool:addjob(function() end)
+pool:synchronize()
+
+-- wait any, wait all
+futures = {}
+for i=1,N do
+   local duration = i == 3 and 0.01 or 0.5
+   futures[i] = pool:submit(function() spin(duration) return i end)
+end
+local idx, first = threads.Threads.waitany(futures)
+assert(idx == 3 and first:get() == 3)
+assert(threads.Threads.waitall(futures, 0.01) == false)
+assert(threads.Threads.waitall(futures) == true)
+for i=1,N do
+   assert(futures[i]:get() == i)
+end
+assert(threads.Threads.waitany({pool:submit(function() spin(0.2) end)}, 0.01) == nil)
+pool:synchronize()
+
+-- specific mode
+pool:specific(true)
+for i=1,N do
+   assert(pool:submit(i, function() return __threadid end):get() == i)
+end
+
+pool:terminate()
+
+print('PASSED')
@@ -0,0 +1,67 @@
+local threads = require 'threads'
+
+-- counts, in a thread, the leases it ran (a module stays loaded across
+-- leases), and sets a global (which does not)
+local function init(threadid)
+   local leases = package.loaded['test.leases'] or {n=0}
+   package.loaded['test.leases'] = leases
+   leases.n = leases.n + 1
+   local leaked = foo
+   foo = threadid
+   return leases.n, leaked
+end
+
+local N = 2
+local pool, initres = threads.Threads(N, {global=true}, init)
+assert(#initres == N)
+for _, res in ipairs(initres) do
+   assert(res[1] == 1 and res[2] == nil)
+end
+local sum = 0
+for i=1,100 do
+   pool:addjob(function(i) return i end, function(i) sum = sum + i end, i)
+end
+pool:synchronize()
+assert(sum == 5050)
+pool:terminate()
+print('first lease ok')
+
+-- the same threads again: modules are still loaded, globals are gone
+pool, initres = threads.Threads(N, {global=true}, init)
+for _, res in ipairs(initres) do
+   assert(res[1] == 2, 'thread not reused')
+   assert(res[2] == nil, 'global leaked from the previous lease')
+end
+pool:terminate()
+
+-- more threads than the idle ones; two pools at once
+local pool1 = threads.Threads(N+1, {global=true}, init)
+local pool2 = threads.Threads(1, {global=true}, init)
+local leases = {}
+for _, p in ipairs{pool1, pool2} do
+   p:specific(true)
+   for i=1,p.N do
+      p:addjob(i,
+               function()
+                  return package.loaded['test.leases'].n
+               end,
+               function(n)
+                  table.insert(leases, n)
+               end)
+   end
+   p:synchronize()
+end
+table.sort(leases)
+assert(table.concat(leases, ' ') == '1 1 3 3', table.concat(leases, ' '))
+
+-- resizing leases and gives back threads
+pool1:resize(1)
+pool1:resize(3)
+pool1:terminate()
+pool2:terminate()
+
+assert(not pcall(threads.Threads, 1, {global=true, stacksize=1048576}), 'placement should fail')
+assert(threads.Threads.shutdown() == N+2)
+assert(threads.Threads.shutdown() == 0)
+
+print('PASSED')
@@ -0,0 +1,59 @@
+local threads = require 'threads'
+
+-- atomic counter
+local counter = threads.Atomic()
+assert(counter:get() == 0)
+assert(counter:add(5) == 0 and counter:add() == 5 and counter:get() == 6)
+counter:set(-3)
+assert(counter:get() == -3)
+local shared = threads.Atomic(counter:id())
+shared:add(3)
+shared:free()
+assert(counter:get() == 0)
+
+local N = 4
+local pool = threads.Threads(N)
+
+-- every index is seen once, whatever the grain
+local counterid = counter:id()
+for _, grain in ipairs{1, 7, 1000} do
+   pool:parallelFor(1, 1000,
+                    function(i)
+                       local counter = require('threads').Atomic(counterid)
+                       counter:add(i)
+                       counter:free()
+                    end,
+                    {grain=grain})
+   assert(counter:get() == 500500, 'wrong sum with grain ' .. grain)
+   counter:set(0)
+end
+counter:free()
+
+-- map reduce
+local sum = pool:mapReduce({1, 10000}, function(i) return i end, function(a, b) return a+b end)
+assert(sum == 50005000)
+local function max(a, b) return a > b and a or b end
+local maximum = pool:mapReduce({-50, 50}, function(i) return (i-3)^2 end, max, {grain=3})
+assert(maximum == 53^2)
+local strings = pool:mapReduce({1, 10}, function(i) return {i} end,
+                               function(a, b)
+                                  for _, x in ipairs(b) do
+                                     table.insert(a, x)
+                                  end
+                                  return a
+                               end)
+table.sort(strings)
+assert(#strings == 10 and strings[1] == 1 and strings[10] == 10)
+assert(pool:mapReduce({1, 0}, function(i) return i end, max) == nil)
+
+-- errors
+local status, msg = pcall(pool.parallelFor, pool, 1, 100, function(i) assert(i ~= 42, 'bad index') end)
+assert(not status and msg:match('bad index'))
+
+-- in specific mode, one job per thread
+pool:specific(true)
+assert(pool:mapReduce({1, 100}, function(i) return 1 end, function(a, b) return a+b end) == 100)
+
+pool:terminate()
+
+print('PASSED')
@@ -0,0 +1,132 @@
+local threads = require 'threads'
+
+local function spin(seconds)
+   local now = require('threads').now
+   local t = now()
+   while now() - t < seconds do
+   end
+end
+
+-- ordered output, across stages of several threads (which drop items)
+local pipeline = threads.Pipeline(
+   {
+      {function(x) return x*x end, threads=2},
+      {function(x) if x % 3 ~= 0 then return x end end},
+      {function(x) return x + offset, 'label' end, threads=2,
+       init={function(threadid) offset = 1 end}}
+   },
+   {ordered=true, size=4})
+
+local N = 100
+local expected = {}
+for i=1,N do
+   pipeline:push(i) -- more items than the channels hold
+   if (i*i) % 3 ~= 0 then
+      table.insert(expected, i*i + 1)
+   end
+end
+pipeline:close()
+local results = {}
+while true do
+   local x, label = pipeline:pop()
+   if x == nil then
+      break
+   end
+   assert(label == 'label')
+   table.insert(results, x)
+end
+assert(#results == #expected, 'wrong number of items')
+for i=1,#expected do
+   assert(results[i] == expected[i], 'wrong order')
+end
+local stats = pipeline:stats()
+assert(stats.pushed == N)
+assert(stats.stages[1].items == N and stats.stages[2].items == N)
+assert(stats.stages[3].items == #expected)
+pipeline:terminate()
+print('ordered ok')
+
+-- batches, and the slowest stage
+pipeline = threads.Pipeline(
+   {
+      {function(x) return x end},
+      {function(x)
+          local t = require('threads').now()
+          while require('threads').now() - t < 0.002 do
+          end
+          return x
+       end,
+       threads=2},
+      {function(items)
+          local sum = 0
+          for _, item in ipairs(items) do
+             sum = sum + item[1]
+          end
+          return sum, #items
+       end,
+       batch=8}
+   })
+local nbatch, total, count = 0, 0, 0
+for i=1,50 do
+   pipeline:push(i)
+end
+pipeline:close()
+while true do
+   local sum, n = pipeline:pop()
+   if sum == nil then
+      break
+   end
+   nbatch = nbatch + 1
+   total = total + sum
+   count = count + n
+end
+assert(total == 50*51/2 and count == 50)
+assert(nbatch >= 7) -- 7 full batches, and what is left
+stats = pipeline:stats()
+assert(stats.slowest == 2, 'the second stage should be the slowest')
+assert(stats.stages[2].busy >= 0.9*50*0.002)
+pipeline:terminate()
+print('batch ok')
+
+-- ordered batches
+pipeline = threads.Pipeline(
+   {
+      {function(x) return x end, threads=2},
+      {function(items) return items[1][1], items[#items][1] end, batch=3}
+   },
+   {ordered=true})
+for i=1,10 do
+   pipeline:push(i)
+end
+pipeline:close()
+local first, last = pipeline:pop()
+assert(first == 1 and last == 3)
+first, last = pipeline:pop()
+assert(first == 4 and last == 6)
+first, last = pipeline:pop()
+first, last = pipeline:pop()
+assert(first == 10 and last == 10)
+assert(pipeline:pop() == nil)
+pipeline:terminate()
+
+-- errors of a stage reach the main thread
+pipeline = threads.Pipeline(
+   {
+      {function(x) return x end},
+      {function(x) if x == 5 then error('bad item') end return x end}
+   },
+   {size=2})
+local status, err = pcall(
+   function()
+      for i=1,20 do
+         pipeline:push(i)
+      end
+      pipeline:close()
+      while pipeline:pop() do
+      end
+   end)
+assert(not status and err:match('bad item'), 'error expected')
+pipeline:terminate()
+print('errors ok')
+
+print('PASSED')
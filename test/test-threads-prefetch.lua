@@ -0,0 +1,74 @@
+local threads = require 'threads'
+require 'torch'
+
+-- slots of a batch of inputs and their targets, filled in place by two
+-- threads, borrowed and released by the main thread
+local K, B, N = 3, 4, 20
+local ring = threads.Prefetch(K, function(i) return torch.FloatTensor(B, 8), torch.LongTensor(B) end)
+
+local pool = threads.Threads(2, function() require 'torch' end)
+pool:specific(true)
+for t=1,2 do
+   pool:addjob(t,
+               function(ring, first)
+                  local ring = require('threads').Prefetch(ring)
+                  for j=first,N,2 do
+                     local i, input, target = ring:acquire()
+                     input:fill(j)
+                     target:fill(j)
+                     ring:publish(i)
+                  end
+               end,
+               nil,
+               ring, t)
+end
+
+local storages, sum = {}, 0
+for j=1,N do
+   local i, input, target = ring:borrow()
+   assert(i >= 1 and i <= K)
+   assert(input:size(1) == B and input:size(2) == 8)
+   assert(input:min() == input:max() and input[1][1] == target[1])
+   storages[torch.pointer(input:storage())] = true
+   sum = sum + target[1]
+   ring:release(i)
+end
+pool:synchronize()
+assert(sum == N*(N+1)/2, 'wrong batches')
+local nstorage = 0
+for _ in pairs(storages) do
+   nstorage = nstorage + 1
+end
+assert(nstorage == K, 'slots should be reused, not allocated')
+print('ring ok')
+
+-- only the thread holding a slot gives it back
+local i = ring:acquire()
+assert(not pcall(ring.release, ring, i+1 > K and 1 or i+1))
+ring:publish(i)
+assert(ring:borrow() == i)
+ring:release(i)
+
+-- closed: no more free slots, the filled ones left can still be borrowed
+i = ring:acquire()
+ring:publish(i)
+ring:close()
+assert(ring:isclosed())
+assert(ring:acquire() == nil)
+assert(ring:borrow() == i)
+ring:release(i) -- dropped
+assert(ring:borrow() == nil)
+pool:terminate()
+
+-- a collected ring is closed, and its slots dropped
+ring = threads.Prefetch(2, function() return torch.FloatTensor(4) end)
+i = ring:acquire()
+ring:publish(i)
+local readyid = ring.readyid
+ring = nil
+collectgarbage()
+collectgarbage()
+local ready = threads.Channel.attach(readyid)
+assert(ready:isclosed() and ready:recv() == nil)
+
+print('PASSED')
@@ -0,0 +1,75 @@
+local threads = require 'threads'
+
+local function spin(seconds)
+   local now = require('threads').now
+   local t = now()
+   while now() - t < seconds do
+   end
+end
+
+-- keeps the thread of a single thread pool busy, once it started
+local function block(pool)
+   local started = threads.Semaphore()
+   pool:addjob(
+      function(id)
+         local started = require('threads').Semaphore(id)
+         started:post()
+         started:free()
+         spin(0.2)
+      end,
+      nil,
+      started:id())
+   started:wait()
+   started:free()
+end
+
+-- a single thread, busy while the jobs are queued (one per lane, as a lane
+-- holds as many jobs as there are threads): higher priorities come first
+local pool = threads.Threads(1, {priorities=3})
+local order = {}
+block(pool)
+for _, priority in ipairs{1, 3, 2} do
+   pool:addjob(priority, function() return priority end, function(p) table.insert(order, p) end)
+end
+pool:synchronize()
+assert(table.concat(order, ' ') == '3 2 1', table.concat(order, ' '))
+
+-- futures and batches
+order = {}
+block(pool)
+local future = pool:submit(1, function() return 'low' end)
+pool:addjobs(3, {{function() return 'high' end, function(x) table.insert(order, x) end}})
+assert(future:get() == 'low')
+pool:synchronize()
+assert(order[1] == 'high')
+assert(not pcall(pool.addjob, pool, 4, function() end), 'unknown priority should fail')
+pool:terminate()
+
+-- aging: every second job is taken from a lower priority first
+pool = threads.Threads(1, {priorities=2, aging=2})
+order = {}
+block(pool)
+for _, priority in ipairs{1, 2} do
+   pool:addjob(priority, function() return priority end, function(p) table.insert(order, p) end)
+end
+pool:synchronize()
+assert(table.concat(order, ' ') == '1 2', table.concat(order, ' '))
+pool:terminate()
+
+-- priorities with several threads and specific mode
+pool = threads.Threads(4, {priorities=2})
+local sum = 0
+for i=1,100 do
+   pool:addjob(i % 2 + 1, function() return i end, function(x) sum = sum + x end)
+end
+pool:synchronize()
+assert(sum == 5050)
+pool:specific(true)
+for i=1,4 do
+   assert(pool:submit(i, function() return __threadid end):get() == i)
+end
+pool:terminate()
+
+assert(not pcall(threads.Threads, 2, {priorities=2, stealing=true}))
+
+print('PASSED')
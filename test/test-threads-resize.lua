@@ -0,0 +1,98 @@
+local threads = require 'threads'
+
+local function spin(seconds)
+   local now = require('threads').now
+   local t = now()
+   while now() - t < seconds do
+   end
+end
+
+-- the id of each thread, and whether it ran the init functions
+local function check(pool)
+   local specific = pool:specific()
+   pool:specific(true)
+   for i=1,pool.N do
+      local id, initialized = pool:submit(i, function() return __threadid, initialized end):get()
+      assert(id == i and initialized == i, string.format('thread %d not initialized', i))
+   end
+   pool:specific(specific)
+   local sum = 0
+   for i=1,100 do
+      if specific then
+         pool:addjob(i % pool.N + 1, function() return i end, function(x) sum = sum + x end)
+      else
+         pool:addjob(function() return i end, function(x) sum = sum + x end)
+      end
+   end
+   pool:synchronize()
+   assert(sum == 5050)
+   assert(#pool:stats().threads == pool.N)
+end
+
+local pool = threads.Threads(2, function(threadid) initialized = threadid end)
+check(pool)
+
+pool:resize(5)
+assert(pool.N == 5)
+check(pool)
+
+pool:resize(1)
+assert(pool.N == 1)
+check(pool)
+
+-- in specific mode, and with pending jobs
+pool:specific(true)
+pool:addjob(1, function() spin(0.05) end)
+pool:resize(3)
+check(pool)
+pool:addjob(2, function() spin(0.05) end)
+pool:resize(2)
+check(pool)
+pool:terminate()
+
+-- priority lanes
+pool = threads.Threads(2, {priorities=2}, function(threadid) initialized = threadid end)
+pool:resize(4)
+check(pool)
+pool:resize(1)
+check(pool)
+pool:terminate()
+
+local stealing = threads.Threads(2, {stealing=true})
+assert(not pcall(stealing.resize, stealing, 3))
+stealing:terminate()
+
+-- autoscaling: an idle pool shrinks, a busy one grows back
+pool = threads.Threads(4, {autoscale={min=1, interval=0.01}},
+                       function(threadid) initialized = threadid end)
+for i=1,10 do
+   spin(0.02)
+   pool:autoscale()
+end
+assert(pool.N == 1, 'idle pool did not shrink')
+check(pool)
+for i=1,200 do
+   pool:addjob(function() spin(0.002) end)
+end
+pool:synchronize()
+assert(pool.N > 1, 'busy pool did not grow')
+assert(pool.N <= 4)
+check(pool)
+
+-- adding jobs does not shrink the pool, synchronize() does
+pool:terminate()
+pool = threads.Threads(4, {autoscale={min=1, interval=0.01, idle=0}},
+                       function(threadid) initialized = threadid end)
+local N = pool.N
+for i=1,2 do -- from 3 threads (the pool shrank once made) to 1
+   spin(0.02)
+   pool:addjob(function() end)
+   assert(pool.N == N, 'addjob shrank the pool')
+   pool:synchronize()
+   assert(pool.N < N, 'synchronize did not shrink the pool')
+   N = pool.N
+end
+check(pool)
+pool:terminate()
+
+print('PASSED')
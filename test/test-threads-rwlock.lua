@@ -0,0 +1,97 @@
+local threads = require 'threads'
+
+local lock = threads.RWLock()
+lock:rdlock()
+lock:unlock()
+lock:wrlock()
+lock:unlock()
+local other = threads.RWLock(lock:id())
+other:rdlock()
+other:unlock()
+other:free()
+print('rwlock ok')
+
+-- shared state: two atomics, which writers keep equal, and readers check
+local N, M = 4, 200
+local a, b = threads.Atomic(), threads.Atomic()
+local ids = {a=a:id(), b=b:id()}
+
+local read = threads.safe(
+   function(ids)
+      local threads = require 'threads'
+      local a, b = threads.Atomic(ids.a), threads.Atomic(ids.b)
+      local consistent = (a:get() == b:get())
+      a:free()
+      b:free()
+      return consistent
+   end,
+   lock, 'shared')
+
+local write = threads.safe(
+   function(ids)
+      local threads = require 'threads'
+      local a, b = threads.Atomic(ids.a), threads.Atomic(ids.b)
+      a:add()
+      local t = threads.now()
+      while threads.now() - t < 0.0001 do
+      end
+      b:add()
+      a:free()
+      b:free()
+   end,
+   lock, 'exclusive')
+
+assert(not pcall(threads.safe, read, threads.Mutex(), 'shared'), 'shared mode needs a rwlock')
+
+local pool = threads.Threads(N)
+local inconsistent = 0
+for i=1,M do
+   pool:addjob(write, nil, ids)
+   for j=1,4 do
+      pool:addjob(read, function(ok) if not ok then inconsistent = inconsistent + 1 end end, ids)
+   end
+end
+pool:synchronize()
+assert(inconsistent == 0, 'readers saw a partial write')
+assert(a:get() == M and b:get() == M)
+print('shared and exclusive ok')
+
+-- striped: one lock per stripe, picked by the hash of the first argument
+local stripes = {}
+for i=1,4 do
+   stripes[i] = threads.RWLock()
+end
+local counters, counterids = {}, {}
+for k=1,8 do
+   counters[k] = {a=threads.Atomic(), b=threads.Atomic()}
+   counterids[k] = {a=counters[k].a:id(), b=counters[k].b:id()}
+end
+
+local update = threads.safe(
+   function(key, ids)
+      local threads = require 'threads'
+      local a, b = threads.Atomic(ids.a), threads.Atomic(ids.b)
+      a:add()
+      b:add()
+      local consistent = (a:get() == b:get())
+      a:free()
+      b:free()
+      return consistent
+   end,
+   stripes, 'exclusive')
+
+for i=1,M do
+   local k = i % 8 + 1
+   pool:addjob(update, function(ok) if not ok then inconsistent = inconsistent + 1 end end, 'key' .. k, counterids[k])
+end
+pool:synchronize()
+assert(inconsistent == 0, 'striped writers collided')
+local total = 0
+for k=1,8 do
+   total = total + counters[k].a:get()
+end
+assert(total == M)
+assert(not pcall(update, {}, counterids[1]), 'keys are numbers, strings or booleans')
+
+pool:terminate()
+print('PASSED')
@@ -0,0 +1,84 @@
+local threads = require 'threads'
+local Queue = require 'threads.queue'
+
+local function spin(seconds)
+   local now = require('threads').now
+   local t = now()
+   while now() - t < seconds do
+   end
+end
+
+-- queue counters
+local q = Queue(4, 'threads.serialize')
+for i=1,3 do
+   q:addjob(function() end)
+end
+q:dojob()
+q:dojob()
+local stats = q:stats()
+assert(stats.size == 4)
+assert(stats.enqueued == 3 and stats.dequeued == 2)
+assert(stats.depth == 1 and stats.maxdepth == 3)
+assert(stats.nblockedempty == 0 and stats.nblockedfull == 0)
+
+q:dojob()
+assert(q:pop(0.05) == nil)
+stats = q:stats()
+assert(stats.depth == 0 and stats.maxdepth == 3)
+assert(stats.nblockedempty == 1 and stats.blockedempty >= 0.04)
+
+-- flat arguments reuse the buffers given back by dojob()
+assert(stats.nallocated == 3) -- the 3 jobs above were queued at once
+for i=1,10 do
+   q:addjob(function(x) assert(x == i) end, i)
+   q:dojob()
+end
+assert(q:stats().nallocated == 3)
+print('queue stats ok')
+
+-- pool counters
+local N = 2
+local njob = 20
+local pool = threads.Threads(N)
+
+local before = pool:stats()
+assert(#before.threads == N)
+for i=1,njob do
+   pool:addjob(function() spin(0.005) end)
+end
+pool:synchronize()
+local after = pool:stats()
+
+assert(after.submitted - before.submitted == njob)
+assert(after.completed - before.completed == njob)
+assert(after.pending == 0)
+assert(after.jobs.dequeued - before.jobs.dequeued == njob)
+assert(after.results.enqueued - before.results.enqueued == njob)
+assert(after.jobs.depth == 0 and after.results.depth == 0)
+assert(after.time > before.time)
+
+local jobs, busy = 0, 0
+for i=1,N do
+   local t0, t1 = before.threads[i], after.threads[i]
+   jobs = jobs + t1.jobs - t0.jobs
+   busy = busy + t1.busy - t0.busy
+   assert(t1.idle >= t0.idle and t1.deserialize >= t0.deserialize and t1.serialize >= t0.serialize)
+end
+assert(jobs == njob)
+assert(busy >= 0.9*njob*0.005, 'busy time too small')
+
+-- an idle pool shows up as idle threads
+spin(0.1)
+for i=1,N do
+   pool:addjob(function() spin(0.01) end)
+end
+pool:synchronize()
+local idle = 0
+for i=1,N do
+   idle = idle + pool:stats().threads[i].idle - after.threads[i].idle
+end
+assert(idle >= 0.05, 'idle time too small')
+
+pool:terminate()
+
+print('PASSED')
@@ -0,0 +1,90 @@
+local threads = require 'threads'
+
+local nthread = 4
+local njob = 100
+
+local pool = threads.Threads(
+   nthread,
+   {stealing=true},
+   function(threadid)
+      assert(__threadid == threadid)
+   end
+)
+
+-- jobs are spread over the threads
+local sum = 0
+for i=1,njob do
+   pool:addjob(
+      function(i)
+         return i, __threadid
+      end,
+      function(i, id)
+         assert(id >= 1 and id <= nthread)
+         sum = sum + i
+      end,
+      i
+   )
+end
+pool:synchronize()
+assert(sum == njob*(njob+1)/2)
+
+-- a blocked thread does not hold back the jobs queued behind it
+local mutex = threads.Mutex()
+local mutexid = mutex:id()
+mutex:lock()
+pool:addjob(
+   function()
+      local threads = require 'threads'
+      local mutex = threads.Mutex(mutexid)
+      mutex:lock()
+      mutex:unlock()
+      mutex:free()
+   end
+)
+local ndone = 0
+for i=1,njob do
+   pool:addjob(
+      function()
+      end,
+      function()
+         ndone = ndone + 1
+      end
+   )
+end
+while ndone < njob do
+   pool:dojob()
+end
+mutex:unlock()
+pool:synchronize()
+mutex:free()
+
+-- specific mode still works
+pool:specific(true)
+for i=1,nthread do
+   pool:addjob(
+      i,
+      function()
+         return __threadid
+      end,
+      function(id)
+         assert(id == i)
+      end
+   )
+end
+pool:synchronize()
+pool:specific(false)
+
+-- batches
+local nbatch = 0
+for b=1,10 do
+   pool:addjobs{
+      {function() end, function() nbatch = nbatch + 1 end},
+      {function() end, function() nbatch = nbatch + 1 end}
+   }
+end
+pool:synchronize()
+assert(nbatch == 20)
+
+pool:terminate()
+
+print('PASSED')
@@ -0,0 +1,115 @@
+local threads = require 'threads'
+local Queue = require 'threads.queue'
+
+local N = 4
+
+-- semaphores
+local s = threads.Semaphore()
+assert(s:value() == 0)
+assert(not s:trywait())
+s:post(2)
+assert(s:value() == 2)
+assert(s:trywait())
+s:wait()
+assert(not s:timedwait(0.05), 'semaphore timedwait should time out')
+
+-- a semaphore shared by id, posted from other threads
+local posters = {}
+for i=1,N do
+   posters[i] = threads.Thread(string.format([[
+      local threads = require 'threads'
+      local s = threads.Semaphore(%d)
+      s:post()
+      s:free()
+   ]], s:id()))
+end
+for i=1,N do
+   assert(s:timedwait(10), 'semaphore post missed')
+end
+for i=1,N do
+   posters[i]:free()
+end
+print('semaphores ok')
+
+-- condition broadcast wakes up all the waiting threads
+local m = threads.Mutex()
+local c = threads.Condition()
+local ready = threads.Semaphore()
+local done = threads.Semaphore()
+local waiters = {}
+for i=1,N do
+   waiters[i] = threads.Thread(string.format([[
+      local threads = require 'threads'
+      local m = threads.Mutex(%d)
+      local c = threads.Condition(%d)
+      local ready = threads.Semaphore(%d)
+      local done = threads.Semaphore(%d)
+      m:lock()
+      ready:post()
+      c:wait(m)
+      m:unlock()
+      done:post()
+   ]], m:id(), c:id(), ready:id(), done:id()))
+end
+for i=1,N do
+   ready:wait()
+end
+m:lock() -- all the threads are waiting on c now
+c:broadcast()
+m:unlock()
+for i=1,N do
+   assert(done:timedwait(10), 'condition broadcast missed a thread')
+end
+for i=1,N do
+   waiters[i]:free()
+end
+
+m:lock()
+assert(not c:timedwait(m, 0.05), 'condition timedwait should time out')
+m:unlock()
+print('conditions ok')
+
+-- queue timeouts
+local q = Queue(4, 'threads.serialize')
+local t = os.time()
+assert(q:pop(0.05) == nil, 'pop should time out')
+assert(select('#', q:dojob(0.05)) == 0, 'dojob should time out')
+assert(Queue.select({q}, 1, 0.05) == nil, 'select should time out')
+q:addjob(function(x) return x+1 end, 41)
+assert(q:dojob(0.05) == 42)
+
+-- closing a queue wakes up its consumers
+local consumer = threads.Thread(string.format([[
+   local Queue = require 'threads.queue'
+   local threads = require 'threads'
+   local q = Queue(%d)
+   local done = threads.Semaphore(%d)
+   while q:dojob() do
+   end
+   done:post()
+]], q:id(), done:id()))
+q:addjob(function() return true end)
+q:close()
+assert(q.isclosed == 1)
+assert(done:timedwait(10), 'closed queue did not wake up its consumer')
+consumer:free()
+assert(q:pop(10) == nil, 'pop on a closed queue should not wait')
+print('queues ok')
+
+-- thread pool
+local pool = threads.Threads(N)
+assert(pool:dojob(0.05) == false, 'dojob should time out without any job')
+local ok = false
+pool:addjob(function() return 1 end, function(x) ok = (x == 1) end)
+assert(pool:dojob(10) == true and ok)
+pool:terminate()
+
+assert(os.time() - t < 10, 'timeouts took too long')
+
+s:free()
+m:free()
+c:free()
+ready:free()
+done:free()
+
+print('PASSED')
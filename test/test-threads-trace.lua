@@ -0,0 +1,46 @@
+local threads = require 'threads'
+
+local N = 2
+local capacity = 8
+local pool = threads.Threads(N, {trace=capacity})
+
+for i=1,20 do
+   pool:addjob(function() return i end, function(x) assert(x == i) end)
+end
+pool:addjobs{{function() return 1 end}, {function() return 2 end}}
+pool:synchronize()
+
+-- only the last jobs of each thread are kept
+local records = pool:trace()
+assert(#records > 0 and #records <= N*capacity)
+for i, record in ipairs(records) do
+   assert(record.thread >= 1 and record.thread <= N)
+   assert(record.submit <= record.submitted)
+   assert(record.submit <= record.dequeued) -- the job may start before addjob() returns
+   assert(record.dequeued <= record.started)
+   assert(record.started <= record.finished)
+   assert(record.finished <= record.received)
+   assert(record.received <= record.done)
+   if i > 1 then
+      assert(records[i-1].submit <= record.submit, 'records not ordered')
+   end
+end
+
+local filename = os.tmpname()
+pool:dumptrace(filename)
+local f = io.open(filename)
+local json = f:read('*a')
+f:close()
+os.remove(filename)
+assert(json:match('^{"traceEvents":%['))
+assert(json:match('"name":"thread 1"'))
+assert(json:match('"name":"job","ph":"X"'))
+assert(json:match('"name":"endcallback","ph":"X","pid":1,"tid":0'))
+pool:terminate()
+
+-- tracing is off by default
+pool = threads.Threads(N)
+assert(not pcall(pool.trace, pool))
+pool:terminate()
+
+print('PASSED')
@@ -1,5 +1,8 @@
 local Queue = require 'threads.queue'
+local placement = require 'threads.placement'
+local Trace = require 'threads.trace'
 local clib = require 'libthreads'
+local now = clib.now
 local _unpack = unpack or table.unpack
 
 local Threads = {}
@@ -33,76 +36,255 @@ function Threads.serialization(name)
    end
 end
 
-function Threads.new(N, ...)
-   local self = {N=N, endcallbacks={n=0}, errors=false, __specific=true, __running=true}
-   local funcs = {...}
-   local serialize = require(Threads.__serialize)
-
-   if #funcs == 0 then
-      funcs = {function() end}
-   end
-
-   setmetatable(self, Threads)
-
-   self.mainqueue = Queue(N, Threads.__serialize)
-   self.threadqueue = Queue(N, Threads.__serialize)
-   self.threadspecificqueues = {}
-   self.mainqueue:retain() -- terminate will free it
-   self.threadqueue:retain() -- terminate will free it
-
-   self.threads = {}
-   for i=1,N do
-      self.threadspecificqueues[i] = Queue(N, Threads.__serialize)
-      self.threadspecificqueues[i]:retain() -- terminate will free it
-
-      local thread = clib.Thread(
-         string.format(
-            [[
+-- code run by each queue thread
+local threadcode = [[
   local Queue = require 'threads.queue'
   __threadid = %d
   local mainqueue = Queue(%d)
   local threadqueue = Queue(%d)
   local threadspecificqueue = Queue(%d)
+  local stealqueues = %s
+  local lanes = %s -- highest priority first
+  local aging = %d
   local threadid = __threadid
+  local _unpack = unpack or table.unpack
+  local now = require('libthreads').now
+
+  local function pack(...)
+     return {n=select('#', ...), ...}
+  end
+
+  -- the lane to look at first: the highest priority, except every aging
+  -- jobs, where it is a lower one (in turn), so they cannot starve
+  local npicked, lower = 0, 1
+  local function lanestart()
+     npicked = npicked + 1
+     if aging > 0 and npicked %% aging == 0 then
+        lower = lower %% (#lanes-1) + 1
+        return lower + 1
+     end
+     return 1
+  end
+
+  -- seconds spent waiting for jobs (idle), loading them (deserialize),
+  -- running them (busy) and sending their results (serialize)
+  local idle, deserialize, busy, serialize = 0, 0, 0, 0
+  local waiting, dequeued, started, finished = now()
+
+  -- jobs from Threads:addjob() carry their endcallback id
+  local function runjob(callback, args, popped)
+     started = now()
+     dequeued = popped
+     idle = idle + popped - waiting
+     deserialize = deserialize + started - popped
+     local endcallbackid = args.__endcallbackid
+     if not endcallbackid then
+        return callback(_unpack(args, 1, args.n or #args))
+     end
+     local status, res = xpcall(
+        function()
+           return pack(callback(_unpack(args, 1, args.n)))
+        end,
+        debug.traceback)
+     if not status then
+        res = {n=1, res}
+     end
+     return status, res, endcallbackid
+  end
+
+  -- the results are sent as flat arguments, which are cheaper to encode
+  -- (with the statistics of the thread so far, and the timeline of the job)
+  local function results(status, endcallbackid, threadid, idle, deserialize, busy, serialize,
+                         dequeued, started, finished, ...)
+     return status, pack(...), endcallbackid, threadid, idle, deserialize, busy, serialize,
+            dequeued, started, finished
+  end
+
+  -- outside of specific mode, the thread also takes the jobs of its own
+  -- queue (looked at first), which are for every thread (see broadcast())
+  local function ownfirst(queues)
+     local all = {threadspecificqueue}
+     for i, queue in ipairs(queues) do
+        all[i+1] = queue
+     end
+     return all
+  end
+  local sharedqueues = ownfirst(stealqueues or lanes or {threadqueue})
 
   __queue_running = true
   __queue_specific = true
   while __queue_running do
      local status, res, endcallbackid
      if __queue_specific then
-       status, res, endcallbackid = threadspecificqueue:dojob()
+       status, res, endcallbackid = threadspecificqueue:dojob(nil, runjob)
+     elseif lanes then
+       local start = lanestart() -- a lane index: lanes come after the own queue
+       status, res, endcallbackid = Queue.dojobany(sharedqueues, start == 1 and 1 or start+1, nil, runjob)
      else
-       status, res, endcallbackid = threadqueue:dojob()
+       status, res, endcallbackid = Queue.dojobany(sharedqueues, 1, nil, runjob)
+     end
+     if status == nil then -- the queues have been closed (see Threads:terminate())
+        break
+     end
+     finished = now()
+     busy = busy + finished - started
+     local args = {n=(res.n or #res)+10, status, endcallbackid, threadid,
+                   idle, deserialize, busy, serialize, dequeued, started, finished,
+                   _unpack(res, 1, res.n or #res)}
+     mainqueue:addjobpacked(results, args, true)
+     waiting = now()
+     serialize = serialize + waiting - finished
+  end
+]]
+
+-- code run by each thread of the global pool: it runs the queue thread
+-- code of a pool (threadcode) for each lease, then restores its globals,
+-- except the modules loaded meanwhile
+local workercode = [[
+  local Queue = require 'threads.queue'
+  local leases = Queue(%d)
+  local returned = require('libthreads').Semaphore(%d)
+  local loadstring = loadstring or load
+
+  local function snapshot()
+     local globals = {}
+     for k, v in pairs(_G) do
+        globals[k] = v
+     end
+     return globals
+  end
+
+  local function restore(globals)
+     local modules = {}
+     for _, module in pairs(package.loaded) do
+        modules[module] = true
+     end
+     for k, v in pairs(_G) do
+        if globals[k] == nil and not modules[v] then
+           _G[k] = nil
+        end
+     end
+     for k, v in pairs(globals) do
+        _G[k] = v
      end
-     mainqueue:addjob(function()
-                          return status, res, endcallbackid, threadid
-                       end)
   end
-]],
-            i,
-            self.mainqueue:id(),
-            self.threadqueue:id(),
-            self.threadspecificqueues[i]:id()
-         ))
 
-      assert(thread, string.format('%d-th thread creation failed', i))
+  while true do
+     local code = leases:dojob()
+     if not code then -- the global pool has been shut down
+        break
+     end
+     local globals = snapshot()
+     local status, msg = pcall(assert(loadstring(code)))
+     if not status then
+        print(string.format('FATAL THREAD PANIC: (lease) %%s', msg))
+     end
+     restore(globals)
+     collectgarbage()
+     returned:post()
+  end
+  returned:free()
+]]
 
-      table.insert(self.threads, thread)
+-- the threads of the global pool which are not leased (see the global
+-- option of Threads.new)
+local idleworkers = {}
+
+-- a thread of the global pool leased by a pool; free() waits until it
+-- is done with the pool (its queues have been closed), and gives it back
+local Lease = {}
+Lease.__index = Lease
+
+function Lease:free()
+   self.worker.returned:wait()
+   table.insert(idleworkers, self.worker)
+end
+
+-- runs code in a thread of the global pool, started if none is idle
+local function lease(code)
+   local worker = table.remove(idleworkers)
+   if not worker then
+      local leases = Queue(1, Threads.__serialize)
+      leases:retain() -- shutdown will free it
+      local returned = clib.Semaphore()
+      local thread = clib.Thread(string.format(workercode, leases:id(), returned:id()))
+      if not thread then
+         leases:free()
+         returned:free()
+         return
+      end
+      worker = {thread=thread, leases=leases, returned=returned}
    end
+   worker.leases:addjob(function(code) return code end, code)
+   return setmetatable({worker=worker}, Lease)
+end
 
-   -- GC: lua 5.1
-   if newproxy then
-      self.__gc__ = newproxy(true)
-      getmetatable(self.__gc__).__gc =
-         function()
-            self:terminate() -- all the queues must be alive (hence the retains above)
-         end
+-- stops the threads of the global pool which are not leased; returns
+-- their number
+function Threads.shutdown()
+   local n = #idleworkers
+   for _, worker in ipairs(idleworkers) do
+      worker.leases:close()
+   end
+   for _, worker in ipairs(idleworkers) do
+      worker.thread:free()
+      worker.leases:free()
+      worker.returned:free()
    end
+   idleworkers = {}
+   return n
+end
 
-   local initres = {}
+-- starts the i-th queue thread, with its own queues
+local function newthread(self, i, attr)
+   local N = self.N
+   local size = self.__queuesize
+   self.threadspecificqueues[i] = Queue(size, Threads.__serialize,
+                                        {adaptive=self.__adaptive, growable=self.__growable})
+   self.threadspecificqueues[i]:retain() -- terminate will free it
+
+   -- results of thread i: single producer (thread i), single consumer (main thread)
+   self.mainqueues[i] = Queue(size, Threads.__serialize, {spsc=true, adaptive=self.__adaptive})
+   self.mainqueues[i]:retain() -- terminate will free it
+
+   -- own queue first, then the others
+   local stealqueues = 'nil'
+   if self.__stealing then
+      local ids = {}
+      for j=0,N-1 do
+         table.insert(ids, string.format('Queue(%d)', self.stealqueues[(i-1+j) % N + 1]:id()))
+      end
+      stealqueues = '{' .. table.concat(ids, ', ') .. '}'
+   end
+
+   local code = string.format(
+      threadcode,
+      i,
+      self.mainqueues[i]:id(),
+      self.threadqueue:id(),
+      self.threadspecificqueues[i]:id(),
+      stealqueues,
+      self.__laneids,
+      self.__aging
+   )
+   local thread
+   if self.__global then
+      thread = lease(code)
+   else
+      thread = clib.Thread(code, attr)
+   end
+
+   assert(thread, string.format('%d-th thread creation failed', i))
+
+   self.threads[i] = thread
+end
+
+-- runs the init functions in threads first to last (in specific mode)
+local function initthreads(self, first, last, initres)
+   local funcs = self.__funcs
    for j=1,#funcs do
-      for i=1,self.N do
-         if j ~= #funcs then
+      for i=first,last do
+         if j ~= #funcs or not initres then
             self:addjob(
                i, -- specific
                funcs[j],
@@ -122,8 +304,115 @@ function Threads.new(N, ...)
          end
       end
    end
+end
+
+function Threads.new(N, ...)
+   local self = {N=N, endcallbacks={n=0}, results={}, errors=false, __specific=true, __running=true}
+   local funcs = {...}
+   local options = {}
+   local serialize = require(Threads.__serialize)
+
+   if type(funcs[1]) == 'table' then
+      options = table.remove(funcs, 1)
+   end
+   self.__stealing = options.stealing and true or false
+   self.__priorities = options.priorities or 1
+   assert(type(self.__priorities) == 'number' and self.__priorities >= 1, 'positive number of priorities expected')
+   assert(self.__priorities == 1 or not self.__stealing, 'priorities and stealing cannot be combined')
+   local aging = options.aging or 0
+   assert(type(aging) == 'number' and aging >= 0, 'aging must be a number of jobs')
+   self.__cache = options.cache and true or false
+   local adaptive = options.adaptive and true or false
+   local growable = options.growable and true or false
+   local size = options.queuesize or N -- capacity of each queue
+   assert(type(size) == 'number' and size >= 1, 'positive queue size expected')
+   self.__stats = {started=now(), submitted=0, completed=0, submit=0, threads={}}
+   if options.trace then -- records per thread
+      self.__trace = Trace.new(type(options.trace) == 'number' and options.trace or 10000)
+   end
+   self.__global = options.global and true or false
+   assert(not (self.__global and (options.affinity or options.numa or options.stacksize)),
+          'threads of the global pool cannot be placed')
+   local attrs = placement.assign(N, options) -- where each thread runs
+
+   if #funcs == 0 then
+      funcs = {function() end}
+   end
+
+   setmetatable(self, Threads)
+
+   self.threadqueue = Queue(size, Threads.__serialize, {adaptive=adaptive, growable=growable})
+   self.threadspecificqueues = {}
+   self.mainqueues = {}
+   self.threadqueue:retain() -- terminate will free it
+   self.__mainqueue = 1 -- next result shard to look at
+
+   -- priority lanes: the threads drain the highest priority first (lane 1, the
+   -- lowest priority, is the shared queue)
+   self.lanes = {self.threadqueue}
+   for p=2,self.__priorities do
+      self.lanes[p] = Queue(size, Threads.__serialize, {adaptive=adaptive, growable=growable})
+      self.lanes[p]:retain() -- terminate will free it
+   end
+   local lanes = 'nil'
+   if self.__priorities > 1 then
+      local ids = {}
+      for p=self.__priorities,1,-1 do
+         table.insert(ids, string.format('Queue(%d)', self.lanes[p]:id()))
+      end
+      lanes = '{' .. table.concat(ids, ', ') .. '}'
+   end
+
+   -- stealing mode: one queue per thread, which steals from the others when idle
+   -- (FIFO queues, not owner-LIFO deques: this balances the load, without
+   -- the cache locality of running the newest job first)
+   if self.__stealing then
+      self.stealqueues = {}
+      self.__stealqueue = 1 -- next queue to submit to
+      for i=1,N do
+         self.stealqueues[i] = Queue(size, Threads.__serialize, {adaptive=adaptive, growable=growable})
+         self.stealqueues[i]:retain() -- terminate will free it
+      end
+   end
+
+   self.__queuesize = size
+   self.__adaptive = adaptive
+   self.__growable = growable
+   self.__aging = aging
+   self.__laneids = lanes
+   self.__options = options
+   self.__funcs = funcs
+   self.threads = {}
+   for i=1,N do
+      newthread(self, i, attrs[i])
+   end
+
+   -- GC: lua 5.1
+   if newproxy then
+      self.__gc__ = newproxy(true)
+      getmetatable(self.__gc__).__gc =
+         function()
+            self:terminate() -- all the queues must be alive (hence the retains above)
+         end
+   end
+
+   local initres = {}
+   initthreads(self, 1, N, initres)
    self:specific(false)
 
+   if options.autoscale then
+      local policy = type(options.autoscale) == 'table' and options.autoscale or {}
+      self.__autoscale = {
+         min = policy.min or 1,
+         max = policy.max or N,
+         interval = policy.interval or 1,
+         idle = policy.idle or 0.5
+      }
+      assert(self.__autoscale.min >= 1 and self.__autoscale.min <= self.__autoscale.max,
+             'autoscale needs 1 <= min <= max')
+      self:autoscale()
+   end
+
    return self, initres
 end
 
@@ -140,6 +429,8 @@ function Threads:specific(flag)
    if flag ~= nil then
       assert(type(flag) == 'boolean', 'boolean expected')
       self:synchronize() -- finish jobs first
+      local busy = self.__busy
+      self.__busy = true -- no autoscaling while threads switch
       if self.__specific ~= flag then
          if self.__specific then
             for i=1,self.N do
@@ -158,22 +449,206 @@ function Threads:specific(flag)
          self.__specific = flag
          self:synchronize() -- finish jobs
       end
+      self.__busy = busy
    else
       return self.__specific
    end
 end
 
-function Threads:dojob()
+-- changes the number of queue threads to M; new threads run the init
+-- functions of the pool before taking jobs, while removing threads waits
+-- for the running jobs (like specific()) and lets the surplus threads exit
+function Threads:resize(M)
    checkrunning(self)
-   self.errors = false
-   local callstatus, args, endcallbackid, threadid = self.mainqueue:dojob()
+   assert(type(M) == 'number' and M >= 1 and M == math.floor(M), 'positive number of threads expected')
+   assert(not self.__stealing, 'a pool in stealing mode cannot be resized')
+   local N = self.N
+   local busy = self.__busy
+   self.__busy = true -- no autoscaling meanwhile
+   if M > N then
+      local attrs = placement.assign(M, self.__options)
+      self.N = M
+      for i=N+1,M do
+         newthread(self, i, attrs[i])
+      end
+      -- a new thread starts in specific mode: it runs the init functions,
+      -- then joins the others
+      local specific = self.__specific
+      self.__specific = true
+      initthreads(self, N+1, M)
+      if not specific then
+         for i=N+1,M do
+            self:addjob(i,
+                        function()
+                           __queue_specific = false
+                        end)
+         end
+      end
+      self.__specific = specific
+   elseif M < N then
+      -- the threads only listen to their own queue in specific mode, so
+      -- that the surplus ones exit as it is closed
+      local specific = self.__specific
+      self:specific(true)
+      for i=M+1,N do
+         self.threadspecificqueues[i]:close()
+      end
+      for i=M+1,N do
+         self.threads[i]:free()
+         self.threads[i] = nil
+         self.threadspecificqueues[i]:free()
+         self.threadspecificqueues[i] = nil
+         self.mainqueues[i]:free()
+         self.mainqueues[i] = nil
+         self.__stats.threads[i] = nil
+      end
+      self.N = M
+      self.__mainqueue = 1
+      self:specific(specific)
+   end
+   self.__busy = busy
+end
+
+-- sum of the idle times of the threads (see Threads:stats())
+local function idletime(self)
+   local idle = 0
+   for i=1,self.N do
+      local threadstats = self.__stats.threads[i]
+      idle = idle + (threadstats and threadstats.idle or 0)
+   end
+   return idle
+end
+
+-- applies the autoscale policy: grows the pool (up to max threads) when
+-- jobs wait in the queues for every thread; with shrink, shrinks it by a
+-- thread (down to min) when it has no job and its threads were mostly idle
+-- since the last decision; returns the number of threads
+local function autoscale(self, shrink)
+   local policy = self.__autoscale
+   local t = now()
+   local queued = 0
+   for p=1,self.__priorities do
+      queued = queued + self.lanes[p]:stats().depth
+   end
+   local completed = self.__stats.completed
+   local idle = 1
+   if policy.last and completed ~= policy.completed then
+      idle = (idletime(self) - policy.idletime) / ((t - policy.last)*self.N)
+   end
+
+   local M = self.N
+   if not self.__specific and queued >= self.N then
+      M = math.min(2*self.N, policy.max)
+   elseif shrink and not self:hasjob() and idle >= policy.idle then
+      M = math.max(self.N - 1, policy.min)
+   end
+   if M ~= self.N then
+      self:resize(M)
+   elseif not shrink then
+      -- the decision to shrink is left to synchronize() and dojob()
+      policy.nextgrow = t + policy.interval
+      return self.N
+   end
+
+   policy.last = now()
+   policy.next = policy.last + policy.interval
+   policy.nextgrow = policy.next
+   policy.completed = self.__stats.completed
+   policy.idletime = idletime(self)
+   return self.N
+end
+
+function Threads:autoscale()
+   checkrunning(self)
+   assert(self.__autoscale, 'autoscaling is not enabled')
+   return autoscale(self, true)
+end
+
+-- applies the autoscale policy, if enabled and due; shrinking the pool waits
+-- for its running jobs (see resize()), hence is only done with shrink, when
+-- the caller is waiting for results anyway
+local function checkautoscale(self, shrink)
+   local policy = self.__autoscale
+   if policy and not self.__busy then
+      local t = now()
+      if t >= policy.next and (shrink or t >= policy.nextgrow) then
+         autoscale(self, shrink)
+      end
+   end
+end
+
+-- the next shard to look at first when collecting results (round-robin)
+local function nextmainqueue(self)
+   local idx = self.__mainqueue
+   self.__mainqueue = idx % self.N + 1
+   return idx
+end
+
+-- queue the results coming from the main queues (a batch carries one result per job)
+local function pushresults(self, callstatus, args, endcallbackid, threadid, idle, deserialize, busy, serialize,
+                           dequeued, started, finished)
+   local results = self.results
+   local trace = self.__trace
+   local received = trace and now()
+   local njob = 1
+   if type(endcallbackid) == 'table' then
+      for i=1,#endcallbackid do
+         local record = trace and trace:receive(endcallbackid[i], threadid, dequeued, started, finished, received)
+         table.insert(results, {args[i][1], args[i][2], endcallbackid[i], threadid, record})
+      end
+      njob = #endcallbackid
+   else
+      local record = trace and trace:receive(endcallbackid, threadid, dequeued, started, finished, received)
+      table.insert(results, {callstatus, args, endcallbackid, threadid, record})
+   end
+
+   local stats = self.__stats
+   local threadstats = stats.threads[threadid]
+   if not threadstats then
+      threadstats = {jobs=0}
+      stats.threads[threadid] = threadstats
+   end
+   threadstats.jobs = threadstats.jobs + njob
+   threadstats.idle = idle
+   threadstats.deserialize = deserialize
+   threadstats.busy = busy
+   threadstats.serialize = serialize
+   stats.completed = stats.completed + njob
+end
+
+-- the result of a job given to Threads:submit(), which takes the place
+-- of its endcallback
+local Future = {}
+Future.__index = Future
+
+local function newfuture(pool)
+   return setmetatable({__pool=pool, __done=false}, Future)
+end
+
+-- called when the result of the job reaches the main thread
+local function resolve(future, callstatus, args, threadid)
+   future.__done = true
+   future.__status = callstatus
+   future.__results = args
+   future.__threadid = threadid
+end
+
+local function doresult(self, callstatus, args, endcallbackid, threadid, record)
    local endcallback = self.endcallbacks[endcallbackid]
    self.endcallbacks[endcallbackid] = nil
    self.endcallbacks.n = self.endcallbacks.n - 1
-   if callstatus then
+   if getmetatable(endcallback) == Future then -- errors are raised by get()
+      resolve(endcallback, callstatus, args, threadid)
+      if record then
+         self.__trace:done(record, now())
+      end
+   elseif callstatus then
       local endcallstatus, msg = xpcall(
-        function() return endcallback(_unpack(args)) end,
+        function() return endcallback(_unpack(args, 1, args.n or #args)) end,
         debug.traceback)
+      if record then
+         self.__trace:done(record, now())
+      end
       if not endcallstatus then
          self.errors = true
          error(string.format('[thread %d endcallback] %s', threadid, msg))
@@ -184,64 +659,472 @@ function Threads:dojob()
    end
 end
 
-function Threads:acceptsjob(idx)
+-- returns false if no result came within timeout seconds (if given)
+function Threads:dojob(timeout)
    checkrunning(self)
+   checkautoscale(self, true)
+   self.errors = false
+   if #self.results == 0 then
+      local callstatus, args, endcallbackid, threadid, idle, deserialize, busy, serialize, dequeued, started, finished =
+         Queue.dojobany(self.mainqueues, nextmainqueue(self), timeout)
+      if endcallbackid == nil then
+         return false
+      end
+      pushresults(self, callstatus, args, endcallbackid, threadid, idle, deserialize, busy, serialize,
+                  dequeued, started, finished)
+   end
+   doresult(self, _unpack(table.remove(self.results, 1), 1, 5))
+   return true
+end
+
+function Threads:dojobs(max)
+   checkrunning(self)
+   self.errors = false
+   assert(max == nil or (type(max) == 'number' and max >= 1), 'positive number of jobs expected')
+   local results = self.results
+   if #results == 0 then
+      for _, result in ipairs(Queue.dojobsany(self.mainqueues, max, nextmainqueue(self))) do
+         pushresults(self, _unpack(result, 1, 11))
+      end
+   end
+   local n = math.min(max or #results, #results)
+   for i=1,n do
+      doresult(self, _unpack(table.remove(results, 1), 1, 5))
+   end
+   return n
+end
+
+local function checkpriority(self, priority)
+   assert(priority == nil or (type(priority) == 'number' and priority >= 1 and priority <= self.__priorities),
+          'priority between 1 and the number of priorities expected')
+end
+
+-- the queue a new job goes to (nil if full); idx is a thread index in
+-- specific mode, a priority otherwise
+local function jobqueue(self, idx)
    local threadqueue
    if self:specific() then
       assert(type(idx) == 'number' and idx >= 1 and idx <= self.N, 'thread index expected')
       threadqueue = self.threadspecificqueues[idx]
+   elseif self.__stealing then
+      checkpriority(self, idx)
+      -- spread the jobs over the threads, skipping full queues
+      for i=0,self.N-1 do
+         local j = (self.__stealqueue-1+i) % self.N + 1
+         if self.stealqueues[j].isfull ~= 1 then
+            self.__stealqueue = j % self.N + 1
+            return self.stealqueues[j]
+         end
+      end
+      return nil
+   elseif idx then
+      checkpriority(self, idx)
+      threadqueue = self.lanes[idx]
    else
       threadqueue = self.threadqueue
    end
-   return threadqueue.isfull ~= 1
+   if threadqueue.isfull ~= 1 then
+      return threadqueue
+   end
 end
 
-function Threads:addjob(...) -- endcallback is passed with returned values of callback
+function Threads:acceptsjob(idx)
    checkrunning(self)
-   self.errors = false
-   local endcallbacks = self.endcallbacks
-
-   local idx, threadqueue, r, callback, endcallback
    if self:specific() then
-      idx = select(1, ...)
       assert(type(idx) == 'number' and idx >= 1 and idx <= self.N, 'thread index expected')
-      threadqueue = self.threadspecificqueues[idx]
+      return self.threadspecificqueues[idx].isfull ~= 1
+   elseif self.__stealing then
+      checkpriority(self, idx)
+      for i=1,self.N do
+         if self.stealqueues[i].isfull ~= 1 then
+            return true
+         end
+      end
+      return false
+   elseif idx then
+      checkpriority(self, idx)
+      return self.lanes[idx].isfull ~= 1
+   else
+      return self.threadqueue.isfull ~= 1
+   end
+end
+
+local function newendcallback(endcallbacks, endcallback)
+   local endcallbackid = #endcallbacks+1
+   endcallbacks[endcallbackid] = endcallback or function() end
+   endcallbacks.n = endcallbacks.n + 1
+   return endcallbackid
+end
+
+-- queues callback(...) in threadqueue, with the given endcallback
+local function queuejob(self, threadqueue, callback, endcallback, ...)
+   -- add a new endcallback in the list
+   local endcallbackid = newendcallback(self.endcallbacks, endcallback)
+
+   local args = {n=select('#', ...), __endcallbackid=endcallbackid, ...}
+   local stats = self.__stats
+   local start = now()
+   threadqueue:addjobpacked(callback, args, self.__cache)
+   local finish = now()
+   stats.submit = stats.submit + finish - start
+   stats.submitted = stats.submitted + 1
+   if self.__trace then
+      self.__trace:submit(endcallbackid, start, finish)
+   end
+end
+
+-- queues callback(...) for thread idx (in specific mode), with the given endcallback
+local function pushjob(self, idx, callback, endcallback, ...)
+   -- finish running jobs if no space available
+   local threadqueue = jobqueue(self, idx)
+   while not threadqueue do
+      self:dojob()
+      threadqueue = jobqueue(self, idx)
+   end
+   queuejob(self, threadqueue, callback, endcallback, ...)
+end
+
+-- the arguments of addjob(): thread index or priority (if any), callback,
+-- endcallback, and the position of the first argument of callback
+local function jobarguments(self, ...)
+   local idx, r, callback, endcallback
+   if self:specific() or type((...)) == 'number' then -- thread index, or priority
+      idx = select(1, ...)
+      if self:specific() then
+         assert(type(idx) == 'number' and idx >= 1 and idx <= self.N, 'thread index expected')
+      else
+         checkpriority(self, idx)
+      end
       callback = select(2, ...)
       endcallback = select(3, ...)
       r = 4
    else
       callback = select(1, ...)
       endcallback = select(2, ...)
-      threadqueue = self.threadqueue
       r = 3
    end
    assert(type(callback) == 'function', 'function callback expected')
    assert(type(endcallback) == 'function' or type(endcallback) == 'nil', 'function (or nil) endcallback expected')
+   return idx, callback, endcallback, r
+end
+
+function Threads:addjob(...) -- endcallback is passed with returned values of callback
+   checkrunning(self)
+   checkautoscale(self)
+   self.errors = false
+   local idx, callback, endcallback, r = jobarguments(self, ...)
+   pushjob(self, idx, callback, endcallback, select(r, ...))
+end
+
+-- like addjob(), but returns false instead of running endcallbacks when
+-- there is no room for the job (true if it was queued)
+function Threads:tryaddjob(...)
+   checkrunning(self)
+   checkautoscale(self)
+   self.errors = false
+   local idx, callback, endcallback, r = jobarguments(self, ...)
+   local threadqueue = jobqueue(self, idx) -- the main thread is the only producer
+   if not threadqueue then
+      return false
+   end
+   queuejob(self, threadqueue, callback, endcallback, select(r, ...))
+   return true
+end
+
+-- runs callback(...) once in every thread, between the jobs it takes
+-- (the pool is not drained); endcallback is passed with the returned
+-- values of each thread
+function Threads:broadcast(callback, endcallback, ...)
+   checkrunning(self)
+   self.errors = false
+   assert(type(callback) == 'function', 'function callback expected')
+   assert(type(endcallback) == 'function' or type(endcallback) == 'nil', 'function (or nil) endcallback expected')
+   for i=1,self.N do
+      local threadqueue = self.threadspecificqueues[i] -- looked at first by thread i
+      while threadqueue.isfull == 1 do
+         self:dojob()
+      end
+      queuejob(self, threadqueue, callback, endcallback, ...)
+   end
+end
+
+-- like addjob(), but returns a future instead of taking an endcallback
+function Threads:submit(...)
+   checkrunning(self)
+   checkautoscale(self)
+   self.errors = false
+
+   local idx, r, callback
+   if self:specific() or type((...)) == 'number' then -- thread index, or priority
+      idx = select(1, ...)
+      if self:specific() then
+         assert(type(idx) == 'number' and idx >= 1 and idx <= self.N, 'thread index expected')
+      else
+         checkpriority(self, idx)
+      end
+      callback = select(2, ...)
+      r = 3
+   else
+      callback = select(1, ...)
+      r = 2
+   end
+   assert(type(callback) == 'function', 'function callback expected')
+
+   local future = newfuture(self)
+   pushjob(self, idx, callback, future, select(r, ...))
+   return future
+end
+
+-- true if the result of the job is there (does not wait)
+function Future:ready()
+   while not self.__done and self.__pool:dojob(0) do
+   end
+   return self.__done
+end
+
+-- executes the endcallbacks of the results reaching the main thread until
+-- the result of the job is there, or timeout seconds (if given) elapsed;
+-- returns false in the latter case
+function Future:wait(timeout)
+   local deadline = timeout and now() + timeout
+   while not self.__done do
+      local remaining = deadline and math.max(deadline - now(), 0)
+      if not self.__pool:dojob(remaining) and remaining == 0 then
+         break
+      end
+   end
+   return self.__done
+end
+
+-- waits for the job, and returns the values returned by its callback (or
+-- raises the error of the callback)
+function Future:get()
+   self:wait()
+   if not self.__status then
+      error(string.format('[thread %d callback] %s', self.__threadid, self.__results[1]))
+   end
+   local results = self.__results
+   return _unpack(results, 1, results.n or #results)
+end
+
+-- waits until one of the futures (of the same pool) is ready, at most
+-- timeout seconds (if given); returns its index and the future, or nothing
+-- if the timeout elapsed
+function Threads.waitany(futures, timeout)
+   assert(type(futures) == 'table' and #futures > 0, 'table of futures expected')
+   local pool = futures[1].__pool
+   local deadline = timeout and now() + timeout
+   while true do
+      for i, future in ipairs(futures) do
+         assert(future.__pool == pool, 'futures of the same pool expected')
+         if future.__done then
+            return i, future
+         end
+      end
+      local remaining = deadline and math.max(deadline - now(), 0)
+      if not pool:dojob(remaining) and remaining == 0 then
+         return
+      end
+   end
+end
+
+-- waits until all the futures are ready, at most timeout seconds (if
+-- given); returns false if the timeout elapsed
+function Threads.waitall(futures, timeout)
+   assert(type(futures) == 'table', 'table of futures expected')
+   local deadline = timeout and now() + timeout
+   for _, future in ipairs(futures) do
+      local remaining = deadline and math.max(deadline - now(), 0)
+      if not future:wait(remaining) then
+         return false
+      end
+   end
+   return true
+end
+
+function Threads:addjobs(...) -- one queue entry (and one serialization) for the whole batch
+   checkrunning(self)
+   checkautoscale(self)
+   self.errors = false
+   local endcallbacks = self.endcallbacks
+
+   local idx, threadqueue, jobs
+   if self:specific() or type((...)) == 'number' then -- thread index, or priority
+      idx, jobs = ...
+      if self:specific() then
+         assert(type(idx) == 'number' and idx >= 1 and idx <= self.N, 'thread index expected')
+      else
+         checkpriority(self, idx)
+      end
+   else
+      jobs = ...
+   end
+   assert(type(jobs) == 'table', 'table of jobs expected')
+
+   local callbacks, args = {}, {}
+   for i, job in ipairs(jobs) do
+      assert(type(job) == 'table', 'each job must be a table {callback, [endcallback], [...]}')
+      assert(type(job[1]) == 'function', 'function callback expected')
+      assert(type(job[2]) == 'function' or type(job[2]) == 'nil', 'function (or nil) endcallback expected')
+      local n = 0
+      for k in pairs(job) do
+         if type(k) == 'number' and k > n then
+            n = k
+         end
+      end
+      callbacks[i] = job[1]
+      args[i] = {n=math.max(n-2, 0), _unpack(job, 3, n)}
+   end
+   if #callbacks == 0 then
+      return
+   end
 
    -- finish running jobs if no space available
-   while not self:acceptsjob(idx) do
+   threadqueue = jobqueue(self, idx)
+   while not threadqueue do
       self:dojob()
+      threadqueue = jobqueue(self, idx)
    end
 
-   -- now add a new endcallback in the list
-   local endcallbackid = #endcallbacks+1
-   endcallbacks[endcallbackid] = endcallback or function() end
-   endcallbacks.n = endcallbacks.n + 1
+   local endcallbackids = {}
+   for i, job in ipairs(jobs) do
+      endcallbackids[i] = newendcallback(endcallbacks, job[2])
+   end
 
-   local func = function(...)
-      local args = {...}
-      local res = {
-          xpcall(
-             function()
-                local _unpack = unpack or table.unpack
-                return callback(_unpack(args))
-             end,
-             debug.traceback)}
-      local status = table.remove(res, 1)
-      return status, res, endcallbackid
+   local func = function()
+      local _unpack = unpack or table.unpack
+      local res = {}
+      for i=1,#callbacks do
+         local jobargs = args[i]
+         local jobres = {
+            xpcall(
+               function()
+                  return callbacks[i](_unpack(jobargs, 1, jobargs.n))
+               end,
+               debug.traceback)}
+         local status = table.remove(jobres, 1)
+         res[i] = {status, jobres}
+      end
+      return true, res, endcallbackids
    end
 
-   threadqueue:addjob(func, select(r, ...))
+   local stats = self.__stats
+   local start = now()
+   threadqueue:addjob(func)
+   local finish = now()
+   stats.submit = stats.submit + finish - start
+   stats.submitted = stats.submitted + #callbacks
+   if self.__trace then
+      for i=1,#endcallbackids do
+         self.__trace:submit(endcallbackids[i], start, finish)
+      end
+   end
+end
+
+-- executed by each worker thread: takes chunks of [first, last] from the
+-- shared cursor until there are none left, and reduces them locally (if
+-- reduce is given); returns nothing if no index was taken
+local function runchunks(cursorid, first, last, grain, map, reduce)
+   local cursor = require('threads').Atomic(cursorid)
+   local acc
+   local has = false
+   local status, msg = pcall(
+      function()
+         while true do
+            local start = first + cursor:add(grain)
+            if start > last then
+               break
+            end
+            local stop = math.min(start + grain - 1, last)
+            if reduce then
+               for i=start,stop do
+                  if has then
+                     acc = reduce(acc, map(i))
+                  else
+                     acc = map(i)
+                     has = true
+                  end
+               end
+            else
+               for i=start,stop do
+                  map(i)
+               end
+            end
+         end
+      end
+   )
+   cursor:free() -- the reference of this thread
+   cursor:free() -- the reference taken for this job by submitchunks()
+   if not status then
+      error(msg, 0)
+   end
+   if has then
+      return acc
+   end
+end
+
+-- runs runchunks() on every thread, returns the futures of the results
+local function submitchunks(self, first, last, options, map, reduce)
+   assert(type(first) == 'number' and type(last) == 'number', 'range of numbers expected')
+   assert(type(map) == 'function', 'function expected')
+   options = options or {}
+   local grain = options.grain or math.max(math.ceil((last - first + 1) / (8*self.N)), 1)
+   assert(type(grain) == 'number' and grain >= 1, 'grain must be a positive number')
+   grain = math.floor(grain)
+
+   -- each job holds a reference on the cursor until it is done, so the
+   -- cursor outlives the jobs still queued if waiting for them fails
+   local cursor = clib.Atomic()
+   local futures = {}
+   for i=1,self.N do
+      clib.Atomic(cursor:id()) -- released by the job
+      if self:specific() then
+         futures[i] = self:submit(i, runchunks, cursor:id(), first, last, grain, map, reduce)
+      else
+         futures[i] = self:submit(runchunks, cursor:id(), first, last, grain, map, reduce)
+      end
+   end
+   cursor:free()
+   Threads.waitall(futures)
+   return futures
+end
+
+-- calls body(i) for i in [first, last], spread over the threads in chunks
+-- of options.grain indices
+function Threads:parallelFor(first, last, body, options)
+   checkrunning(self)
+   for _, future in ipairs(submitchunks(self, first, last, options, body)) do
+      future:get()
+   end
+end
+
+-- returns reduce(...reduce(map(i1), map(i2))..., map(iN)) over the indices
+-- of range ({first, last}): the threads reduce their chunks, the main thread
+-- reduces the results of the threads (reduce must be associative and
+-- commutative); returns nothing if the range is empty
+function Threads:mapReduce(range, map, reduce, options)
+   checkrunning(self)
+   assert(type(range) == 'table', 'range {first, last} expected')
+   assert(type(reduce) == 'function', 'function reduce expected')
+   local function result(...) -- true and the value, if there is one
+      return select('#', ...) > 0, ...
+   end
+   local acc
+   local has = false
+   for _, future in ipairs(submitchunks(self, range[1], range[2], options, map, reduce)) do
+      local ok, value = result(future:get())
+      if ok then
+         if has then
+            acc = reduce(acc, value)
+         else
+            acc = value
+            has = true
+         end
+      end
+   end
+   if has then
+      return acc
+   end
 end
 
 function Threads:haserror()
@@ -250,6 +1133,66 @@ function Threads:haserror()
    return false
 end
 
+-- merged statistics of several queues (depths are summed, highest depths are not)
+local function queuestats(queues)
+   local stats = {}
+   for _, queue in ipairs(queues) do
+      for k, v in pairs(queue:stats()) do
+         if k == 'maxdepth' then
+            stats[k] = math.max(stats[k] or 0, v)
+         else
+            stats[k] = (stats[k] or 0) + v
+         end
+      end
+   end
+   return stats
+end
+
+function Threads:stats()
+   checkrunning(self)
+   local stats = self.__stats
+   local jobqueues = {_unpack(self.lanes)}
+   local threads = {}
+   for i=1,self.N do
+      table.insert(jobqueues, self.threadspecificqueues[i])
+      if self.__stealing then
+         table.insert(jobqueues, self.stealqueues[i])
+      end
+      local threadstats = stats.threads[i] or {}
+      threads[i] = {
+         jobs = threadstats.jobs or 0,
+         idle = threadstats.idle or 0,
+         deserialize = threadstats.deserialize or 0,
+         busy = threadstats.busy or 0,
+         serialize = threadstats.serialize or 0
+      }
+   end
+   return {
+      time = now() - stats.started,
+      submitted = stats.submitted,
+      completed = stats.completed,
+      pending = self.endcallbacks.n,
+      submit = stats.submit,
+      jobs = queuestats(jobqueues),
+      results = queuestats(self.mainqueues),
+      threads = threads
+   }
+end
+
+-- records of the last jobs (see the trace option), ordered by submission time
+function Threads:trace()
+   assert(self.__trace, 'tracing is not enabled')
+   return self.__trace:records()
+end
+
+-- writes the records of the last jobs in the Chrome trace format
+function Threads:dumptrace(filename)
+   assert(self.__trace, 'tracing is not enabled')
+   local f = assert(io.open(filename, 'w'))
+   f:write(self.__trace:chrome())
+   f:close()
+end
+
 function Threads:hasjob()
    checkrunning(self)
    return self.endcallbacks.n > 0
@@ -261,8 +1204,9 @@ function Threads:synchronize()
    end
    self.errors = false
    while self:hasjob()do
-      self:dojob()
+      self:dojobs()
    end
+   checkautoscale(self, true)
 end
 
 function Threads:terminate()
@@ -272,35 +1216,35 @@ function Threads:terminate()
 
    local function exit()
 
-      -- terminate the threads
+      -- terminate all jobs
+      self:synchronize()
+
+      -- wake up all the threads at once: they exit as their queue is closed
+      for p=1,self.__priorities do
+         self.lanes[p]:close()
+      end
       for i=1,self.N do
-         if self:specific() then
-            self:addjob(
-            i,
-            function()
-               __queue_running = false
-            end)
-         else
-            self:addjob(
-               function()
-                  __queue_running = false
-               end)
+         self.threadspecificqueues[i]:close()
+         if self.__stealing then
+            self.stealqueues[i]:close()
          end
       end
 
-      -- terminate all jobs
-      self:synchronize()
-
       -- wait for threads to exit (and free them)
       for i=1,self.N do
          self.threads[i]:free()
       end
 
       -- release the queues
-      self.mainqueue:free()
-      self.threadqueue:free()
+      for p=1,self.__priorities do
+         self.lanes[p]:free()
+      end
       for i=1,self.N do
          self.threadspecificqueues[i]:free()
+         self.mainqueues[i]:free()
+         if self.__stealing then
+            self.stealqueues[i]:free()
+         end
       end
 
    end
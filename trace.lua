@@ -0,0 +1,118 @@
+-- Timeline of the jobs of a pool (see the trace option of threads.Threads()).
+-- The worker threads send the timestamps of a job along with its result;
+-- the main thread keeps the records of the last jobs of each worker in a
+-- ring (one per worker, written by the main thread only).
+
+local Trace = {}
+Trace.__index = Trace
+
+-- capacity: number of records kept per worker thread
+function Trace.new(capacity)
+   assert(type(capacity) == 'number' and capacity >= 1, 'positive number of records expected')
+   return setmetatable({capacity=capacity, rings={}, submits={}}, Trace)
+end
+
+-- job id (its endcallback id) was submitted between times start and finish
+function Trace:submit(id, start, finish)
+   self.submits[id] = {start, finish}
+end
+
+-- the result of job id, run by thread threadid, reached the main thread;
+-- returns its record, to be completed by done()
+function Trace:receive(id, threadid, dequeued, started, finished, received)
+   local submit = self.submits[id] or {}
+   self.submits[id] = nil
+   local record = {
+      job = id,
+      thread = threadid,
+      submit = submit[1],
+      submitted = submit[2],
+      dequeued = dequeued,
+      started = started,
+      finished = finished,
+      received = received
+   }
+   local ring = self.rings[threadid]
+   if not ring then
+      ring = {count=0}
+      self.rings[threadid] = ring
+   end
+   ring[ring.count % self.capacity + 1] = record
+   ring.count = ring.count + 1
+   return record
+end
+
+-- the endcallback of a record returned by receive() is over
+function Trace:done(record, time)
+   record.done = time
+end
+
+-- records kept so far, ordered by submission time
+function Trace:records()
+   local records = {}
+   for _, ring in pairs(self.rings) do
+      for i=1,math.min(ring.count, self.capacity) do
+         table.insert(records, ring[i])
+      end
+   end
+   table.sort(records, function(a, b)
+                 return (a.submit or a.dequeued) < (b.submit or b.dequeued)
+              end)
+   return records
+end
+
+local function event(events, fmt, ...)
+   table.insert(events, string.format(fmt, ...))
+end
+
+-- a complete event, on thread tid, from start to finish (seconds)
+local function slice(events, tid, name, start, finish, origin, args)
+   if start and finish then
+      event(events, '{"name":"%s","ph":"X","pid":1,"tid":%d,"ts":%.3f,"dur":%.3f%s}',
+            name, tid, (start-origin)*1e6, math.max(finish-start, 0)*1e6, args or '')
+   end
+end
+
+-- an arrow from thread tid1 at time1 to thread tid2 at time2
+local function flow(events, id, tid1, time1, tid2, time2, origin)
+   if time1 and time2 then
+      event(events, '{"name":"flow","cat":"job","ph":"s","id":%d,"pid":1,"tid":%d,"ts":%.3f}',
+            id, tid1, (time1-origin)*1e6)
+      event(events, '{"name":"flow","cat":"job","ph":"f","bp":"e","id":%d,"pid":1,"tid":%d,"ts":%.3f}',
+            id, tid2, (time2-origin)*1e6)
+   end
+end
+
+-- the records in the Chrome trace event format (JSON), which can be loaded
+-- in chrome://tracing or https://ui.perfetto.dev; the main thread is tid 0,
+-- worker threads are tid 1 to N
+function Trace:chrome()
+   local records = self:records()
+   local origin = records[1] and (records[1].submit or records[1].dequeued) or 0
+   local events = {}
+   event(events, '{"name":"thread_name","ph":"M","pid":1,"tid":0,"args":{"name":"main"}}')
+   local threadids = {}
+   for threadid in pairs(self.rings) do
+      table.insert(threadids, threadid)
+   end
+   table.sort(threadids)
+   for _, threadid in ipairs(threadids) do
+      event(events, '{"name":"thread_name","ph":"M","pid":1,"tid":%d,"args":{"name":"thread %d"}}',
+            threadid, threadid)
+   end
+   for i, record in ipairs(records) do
+      local tid = record.thread
+      slice(events, 0, 'submit', record.submit, record.submitted, origin)
+      slice(events, tid, 'deserialize', record.dequeued, record.started, origin)
+      slice(events, tid, 'job', record.started, record.finished, origin,
+            string.format(',"args":{"job":%d,"queued":%.3f,"waiting":%.3f}', record.job,
+                          record.submitted and math.max(record.dequeued-record.submitted, 0)*1e3 or 0,
+                          (record.received-record.finished)*1e3))
+      slice(events, 0, 'endcallback', record.received, record.done, origin)
+      flow(events, 2*i, 0, record.submit, tid, record.dequeued, origin)
+      flow(events, 2*i+1, tid, record.finished, 0, record.received, origin)
+   end
+   return '{"traceEvents":[\n' .. table.concat(events, ',\n') .. '\n],"displayTimeUnit":"ms"}\n'
+end
+
+return Trace